@@ -0,0 +1,430 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/utsname.h>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <omp.h>
+#include "counters.h"
+#include "topology.h"
+
+#ifndef BENCH_H
+#define BENCH_H
+
+/*	Shared timing harness, so every project measures the same way.
+
+	A Bench times a region warmup times untimed, then reps times timed,
+	and summarizes the timed runs after dropping outliers: min, max, mean,
+	standard deviation, median, 5th and 95th percentiles and a 95%
+	confidence interval for the median. Projects print their own CSV
+	columns from these stats; report( ) also appends one standard record
+	per Bench to the file named by BENCH_OUT, so runs of different
+	projects land in one comparable table.
+
+	Usage, with the region inline:
+		Bench bench( "proj1", nodes * nodes, WARMUP, NUMTRIES );
+		while( bench.next( ) )
+		{
+			... region ...
+		}
+		const BenchStats &s = bench.stats( );
+
+	or as a callable, bench.run( [&]( ) { ... } ), or with samples timed
+	elsewhere, bench.add( seconds ).
+
+	bench.count( threads ) also counts hardware events (counters.h) over
+	the timed runs of next( ) and run( ), when BENCH_COUNTERS is set.
+	CounterHeader( ) and counterColumns( ) then add the per-run counts to
+	a project's CSV, and print nothing when it is not set.
+
+	JSON records also carry the time, BENCH_TAG, the machine (host, CPU
+	model, CPU, core and socket counts, kernel), the last thread placement
+	(topology.h) and the compiler and flags, so a .json file
+	is an append-only results store; Common/benchcmp compares two sets of
+	runs from it and flags significant changes, and Common/scalefit fits
+	scalability models to its thread-count sweeps. The project scripts
+	export BENCH_OUT as ../results.json unless it is already set, so every
+	scripted run lands in the one store at the top of the repo.
+
+	Environment:
+		BENCH_OUT		file to append records to; JSON lines if it ends
+						in .json, otherwise CSV with a header when new
+		BENCH_TAG		label stored with JSON records, e.g. a commit or
+						"baseline", for picking runs to compare
+		BENCH_REPS		overrides reps
+		BENCH_WARMUP	overrides warmup
+		BENCH_COUNTERS	count hardware events where count( ) was called
+		BENCH_TRACE		Chrome trace file for TRACE_SCOPE spans (trace.h)
+*/
+
+#ifndef BENCH_WARMUP
+	#define BENCH_WARMUP 1
+#endif
+
+#ifndef BENCH_REPS
+	#define BENCH_REPS 10
+#endif
+
+// Samples further than this many robust standard deviations (1.4826 MAD) from the median are dropped
+#ifndef BENCH_OUTLIER
+	#define BENCH_OUTLIER 3.5
+#endif
+
+// Compiler flags for the record; scripts may pass the real ones, else they are read off predefined macros
+#ifndef BENCH_FLAGS
+	#define BENCH_FLAGS ""
+#endif
+
+// Keeps value, and everything it was computed from, from being optimized away
+template <typename T>
+inline void DoNotOptimize( const T &value )
+{
+	asm volatile( "" : : "r,m"( value ) : "memory" );
+}
+
+// Keeps the compiler from moving or dropping memory writes across this point
+inline void ClobberMemory( )
+{
+	asm volatile( "" : : : "memory" );
+}
+
+/* Summary of the timed runs that survived outlier rejection, in seconds */
+struct BenchStats
+{
+	int reps;				// timed runs
+	int kept;				// runs left after outlier rejection
+	double min, max;
+	double mean, stddev;
+	double median, p5, p95;
+	double ciLow, ciHigh;	// 95% confidence interval of the median
+};
+
+class Bench
+{
+	public:
+		// work is the amount done per run, in whatever unit the project counts
+		Bench( const char *name, double work, int warmup = BENCH_WARMUP, int reps = BENCH_REPS )
+			: name( name ), work( work ), warmup( EnvInt( "BENCH_WARMUP", warmup ) ),
+			  reps( EnvInt( "BENCH_REPS", reps ) ), started( 0 ), t0( 0. ), dirty( true )
+		{
+			desc[0] = '\0';
+			memset( &summary, 0, sizeof(summary) );
+		}
+
+		/*	Ends the run in progress, if any, and starts the next one.
+			Returns false once warmup + reps runs are done. */
+		bool next( )
+		{
+			ClobberMemory( );
+			double now = omp_get_wtime( );
+			if( started > warmup )
+			{
+				add( now - t0 );
+				if( ctrs ) ctrs->stop( );
+			}
+			if( started >= warmup + reps ) return false;
+
+			started++;
+			if( ctrs && started > warmup ) ctrs->start( );
+			ClobberMemory( );
+			t0 = omp_get_wtime( );
+			return true;
+		}
+
+		template <typename F>
+		const BenchStats &run( F f )
+		{
+			while( next( ) ) f( );
+			return stats( );
+		}
+
+		// Records one timed run measured by the caller
+		void add( double seconds )
+		{
+			samples.push_back( seconds );
+			dirty = true;
+		}
+
+		// Counts hardware events on a team of threads threads, if BENCH_COUNTERS is set
+		void count( int threads )
+		{
+			if( Counters::Enabled( ) ) ctrs.reset( new Counters( threads ) );
+		}
+
+		// The counters, or NULL if not counting
+		const Counters *counters( ) const { return ctrs.get( ); }
+
+		// Counter CSV header fields if BENCH_COUNTERS is set, names prefixed with prefix
+		static void CounterHeader( FILE *fp, const char *prefix = "" )
+		{
+			if( Counters::Enabled( ) ) Counters::Header( fp, prefix );
+		}
+
+		// Counter CSV fields to match CounterHeader( )
+		void counterColumns( FILE *fp ) const
+		{
+			if( ctrs ) ctrs->columns( fp );
+			else if( Counters::Enabled( ) ) Counters::Blank( fp );
+		}
+
+		// Describes the configuration for the record, printf style
+		void config( const char *fmt, ... )
+		{
+			va_list ap;
+			va_start( ap, fmt );
+			vsnprintf( desc, sizeof(desc), fmt, ap );
+			va_end( ap );
+		}
+
+		const BenchStats &stats( )
+		{
+			if( dirty ) Summarize( );
+			return summary;
+		}
+
+		// Millions of work units per second at a given run time
+		double mrate( double seconds ) const { return seconds > 0. ? work / seconds / 1000000. : 0.; }
+
+		int warmups( ) const { return warmup; }
+		int runs( ) const { return warmup + reps; }
+
+		// One human-readable line
+		void print( FILE *fp )
+		{
+			const BenchStats &s = stats( );
+			fprintf( fp, "%s %s: median %.3lf us [%.3lf, %.3lf], p5 %.3lf, p95 %.3lf, %d of %d runs kept\n",
+				name, desc, s.median * 1e6, s.ciLow * 1e6, s.ciHigh * 1e6, s.p5 * 1e6, s.p95 * 1e6, s.kept, s.reps );
+		}
+
+		// Appends this Bench's record to $BENCH_OUT, if set
+		void report( )
+		{
+			const char *path = getenv( "BENCH_OUT" );
+			if( path == NULL || path[0] == '\0' ) return;
+
+			FILE *fp = fopen( path, "a" );
+			if( fp == NULL )
+			{
+				perror( path );
+				return;
+			}
+
+			const BenchStats &s = stats( );
+			size_t len = strlen( path );
+			if( len > 5 && strcmp( path + len - 5, ".json" ) == 0 )
+			{
+				fprintf( fp, "{\"benchmark\":" );
+				JsonString( fp, name );
+				fprintf( fp, ",\"config\":" );
+				JsonString( fp, desc );
+				fprintf( fp, "," );
+				Fingerprint( fp );
+				fprintf( fp, "\"work\":%.17g,\"warmup\":%d,\"reps\":%d,\"kept\":%d,", work, warmup, s.reps, s.kept );
+				fprintf( fp, "\"min\":%.9g,\"max\":%.9g,\"mean\":%.9g,\"stddev\":%.9g,\"median\":%.9g,\"p5\":%.9g,\"p95\":%.9g,",
+					s.min, s.max, s.mean, s.stddev, s.median, s.p5, s.p95 );
+				fprintf( fp, "\"ciLow\":%.9g,\"ciHigh\":%.9g,\"samples\":[", s.ciLow, s.ciHigh );
+				for( size_t i = 0; i < samples.size( ); i++ )
+					fprintf( fp, "%s%.9g", i ? "," : "", samples[i] );
+				fprintf( fp, "]" );
+				if( ctrs )
+				{
+					fprintf( fp, ",\"counters\":" );
+					ctrs->json( fp );
+					fprintf( fp, ",\"threadCounters\":[" );
+					for( int t = 0; t < ctrs->threads( ); t++ )
+					{
+						if( t ) fprintf( fp, "," );
+						ctrs->json( fp, t );
+					}
+					fprintf( fp, "]" );
+				}
+				fprintf( fp, "}\n" );
+			}
+			else
+			{
+				fseek( fp, 0, SEEK_END );
+				if( ftell( fp ) == 0 )
+					fprintf( fp, "Benchmark,Config,Work,Warmup,Reps,Kept,Min s,Max s,Mean s,Stddev s,Median s,P5 s,P95 s,CI Low s,CI High s,Median M/sec,Peak M/sec\n" );
+				fprintf( fp, "%s,%s,%.17g,%d,%d,%d,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%lf,%lf\n",
+					name, desc, work, warmup, s.reps, s.kept, s.min, s.max, s.mean, s.stddev,
+					s.median, s.p5, s.p95, s.ciLow, s.ciHigh, mrate( s.median ), mrate( s.min ) );
+			}
+
+			fclose( fp );
+		}
+
+	private:
+		static int EnvInt( const char *var, int fallback )
+		{
+			const char *v = getenv( var );
+			return v != NULL && v[0] != '\0' ? atoi( v ) : fallback;
+		}
+
+		// Writes s as a JSON string, escaping quotes and backslashes and dropping control characters
+		static void JsonString( FILE *fp, const char *s )
+		{
+			fputc( '"', fp );
+			for( ; *s != '\0'; s++ )
+			{
+				if( *s == '"' || *s == '\\' ) fputc( '\\', fp );
+				if( (unsigned char)*s >= ' ' ) fputc( *s, fp );
+			}
+			fputc( '"', fp );
+		}
+
+		// The time, tag, machine and build fields of a JSON record, each followed by a comma
+		static void Fingerprint( FILE *fp )
+		{
+			char when[32];
+			time_t now = time( NULL );
+			strftime( when, sizeof(when), "%Y-%m-%dT%H:%M:%SZ", gmtime( &now ) );
+
+			const char *tag = getenv( "BENCH_TAG" );
+			char host[256] = "";
+			gethostname( host, sizeof(host) - 1 );
+			struct utsname u;
+			if( uname( &u ) != 0 ) strcpy( u.release, "" );
+
+			// CPU model from the first "model name" line, where there is one
+			char cpu[256] = "", line[512];
+			FILE *info = fopen( "/proc/cpuinfo", "r" );
+			while( info != NULL && fgets( line, sizeof(line), info ) != NULL )
+			{
+				char *colon = strchr( line, ':' );
+				if( strncmp( line, "model name", 10 ) != 0 || colon == NULL ) continue;
+				snprintf( cpu, sizeof(cpu), "%s", colon + 2 );
+				cpu[ strcspn( cpu, "\n" ) ] = '\0';
+				break;
+			}
+			if( info != NULL ) fclose( info );
+
+			fprintf( fp, "\"time\":\"%s\",\"tag\":", when );
+			JsonString( fp, tag != NULL ? tag : "" );
+			fprintf( fp, ",\"host\":" );
+			JsonString( fp, host );
+			fprintf( fp, ",\"cpu\":" );
+			JsonString( fp, cpu );
+			const Topology &topo = Topology::Machine( );
+			fprintf( fp, ",\"cpus\":%d,\"cores\":%d,\"sockets\":%d,\"placement\":", omp_get_num_procs( ), topo.cores( ), topo.sockets( ) );
+			JsonString( fp, Topology::Current( ).c_str( ) );
+			fprintf( fp, ",\"kernel\":" );
+			JsonString( fp, u.release );
+			fprintf( fp, ",\"compiler\":" );
+			#ifdef __VERSION__
+				JsonString( fp, __VERSION__ );
+			#else
+				JsonString( fp, "" );
+			#endif
+			fprintf( fp, ",\"flags\":" );
+			JsonString( fp, BuildFlags( ) );
+			fprintf( fp, "," );
+		}
+
+		// BENCH_FLAGS, or what the predefined macros tell of the flags
+		static const char *BuildFlags( )
+		{
+			if( BENCH_FLAGS[0] != '\0' ) return BENCH_FLAGS;
+			return ""
+			#ifdef __OPTIMIZE__
+				"optimize "
+			#endif
+			#ifdef __OPTIMIZE_SIZE__
+				"optimize-size "
+			#endif
+			#ifdef __FAST_MATH__
+				"fast-math "
+			#endif
+			#ifdef __AVX512F__
+				"avx512f "
+			#endif
+			#ifdef __AVX2__
+				"avx2 "
+			#endif
+			#ifdef __AVX__
+				"avx "
+			#endif
+			#ifdef __FMA__
+				"fma "
+			#endif
+			#ifdef _OPENMP
+				"openmp"
+			#endif
+			;
+		}
+
+		// Linear interpolation between order statistics of sorted x
+		static double Percentile( const std::vector<double> &x, double p )
+		{
+			double pos = p / 100. * ( x.size( ) - 1 );
+			size_t lo = (size_t) pos;
+			if( lo + 1 >= x.size( ) ) return x.back( );
+			return x[lo] + ( pos - lo ) * ( x[lo + 1] - x[lo] );
+		}
+
+		void Summarize( )
+		{
+			dirty = false;
+			memset( &summary, 0, sizeof(summary) );
+			summary.reps = (int) samples.size( );
+			if( samples.empty( ) ) return;
+
+			std::vector<double> x( samples );
+			std::sort( x.begin( ), x.end( ) );
+
+			// Drop samples far from the median in units of the median absolute deviation
+			double med = Percentile( x, 50. );
+			std::vector<double> dev( x.size( ) );
+			for( size_t i = 0; i < x.size( ); i++ )
+				dev[i] = fabs( x[i] - med );
+			std::sort( dev.begin( ), dev.end( ) );
+			double sigma = 1.4826 * Percentile( dev, 50. );
+
+			if( sigma > 0. )
+				x.erase( std::remove_if( x.begin( ), x.end( ),
+					[=]( double t ) { return fabs( t - med ) > BENCH_OUTLIER * sigma; } ), x.end( ) );
+
+			size_t n = x.size( );
+			double sum = 0., sumSq = 0.;
+			for( size_t i = 0; i < n; i++ )
+				sum += x[i];
+			double mean = sum / n;
+			for( size_t i = 0; i < n; i++ )
+				sumSq += ( x[i] - mean ) * ( x[i] - mean );
+
+			summary.kept = (int) n;
+			summary.min = x.front( );
+			summary.max = x.back( );
+			summary.mean = mean;
+			summary.stddev = n > 1 ? sqrt( sumSq / ( n - 1 ) ) : 0.;
+			summary.median = Percentile( x, 50. );
+			summary.p5 = Percentile( x, 5. );
+			summary.p95 = Percentile( x, 95. );
+
+			// Distribution-free: order statistics n/2 -+ 1.96 sqrt(n)/2, clamped to the sample
+			double half = 0.98 * sqrt( (double) n );
+			long lo = (long) floor( n / 2. - half );
+			long hi = (long) ceil( n / 2. + half );
+			summary.ciLow = x[ std::max( lo, 1L ) - 1 ];
+			summary.ciHigh = x[ std::min( hi, (long) n ) - 1 ];
+		}
+
+		const char *name;
+		double work;
+		int warmup;
+		int reps;
+		int started;			// runs begun, warm-ups included
+		double t0;				// start of the run in progress
+		bool dirty;				// samples changed since the last Summarize
+		char desc[256];
+		std::vector<double> samples;
+		BenchStats summary;
+		std::unique_ptr<Counters> ctrs;	// NULL unless count( ) found BENCH_COUNTERS set
+};
+
+
+#endif		// BENCH_H
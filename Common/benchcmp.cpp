@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include "config.h"
+#include "results.h"
+
+/*	Compares two sets of benchmark runs from the JSON results store that
+	Common/bench.h appends to (BENCH_OUT=file.json), and flags throughput
+	changes that are both statistically significant and large enough to
+	matter.
+
+	Runs are grouped by benchmark, configuration and thread placement
+	policy, and every timed sample of a group is pooled across its runs as
+	a throughput, the record's work over the sample's time, so runs doing
+	different amounts of work still compare. A two-sided Mann-Whitney U
+	test on the pooled samples gives p; a group changed if p < alpha and
+	its median throughput moved by at least min percent. Groups whose two
+	sides ran on different machines, compilers or flags are warned about,
+	since their difference is not the code's.
+
+	Run as: benchcmp [alpha=0.05] [min=2] base new
+		base, new	file or file@tag: the records of a store, or only those
+					written with BENCH_TAG=tag
+
+	e.g. BENCH_TAG=before ./script3; (change); BENCH_TAG=after ./script3;
+		 benchcmp results.json@before results.json@after
+
+	Output (CSV): Benchmark,Config,Base Samples,New Samples,Base Median M/sec,
+		New Median M/sec,Throughput Change %,p,Verdict
+	Exit status: 0, 1 if any group regressed, 2 on bad arguments or files.
+*/
+
+#define MINSAMPLES 3	// per side; fewer can never reach p < 0.05
+
+/* Pooled samples of one benchmark and configuration on one side */
+struct Group
+{
+	std::vector<double> samples;	// M work units/sec
+	int runs = 0;
+	std::string machine;	// host, cpu, compiler and flags of the first run
+	bool mixed = false;		// later runs had a different machine
+};
+
+typedef std::map<std::string, Group> Side;	// by "benchmark\tconfig"
+
+// Reads spec (file or file@tag) into side; false if the file cannot be read
+static bool Load( const char *spec, Side &side )
+{
+	std::vector<std::string> records;
+	if( !Results::Read( spec, records ) ) return false;
+
+	for( size_t i = 0; i < records.size( ); i++ )
+	{
+		const std::string &rec = records[i];
+		std::vector<double> samples = Results::Throughputs( rec );
+		std::string machine = Results::Machine( rec );
+
+		Group &g = side[ Results::Field( rec, "benchmark" ) + "\t" + Results::Config( rec ) ];
+		if( g.runs == 0 ) g.machine = machine;
+		else if( g.machine != machine ) g.mixed = true;
+		g.runs++;
+		g.samples.insert( g.samples.end( ), samples.begin( ), samples.end( ) );
+	}
+
+	return true;
+}
+
+static double Median( std::vector<double> x )
+{
+	std::sort( x.begin( ), x.end( ) );
+	size_t n = x.size( );
+	return n % 2 ? x[n / 2] : ( x[n / 2 - 1] + x[n / 2] ) / 2.;
+}
+
+/*	Two-sided p of the Mann-Whitney U test of a against b, by the normal
+	approximation with tie and continuity corrections */
+static double MannWhitney( const std::vector<double> &a, const std::vector<double> &b )
+{
+	double n1 = a.size( ), n2 = b.size( ), n = n1 + n2;
+
+	std::vector< std::pair<double, int> > all;
+	for( size_t i = 0; i < a.size( ); i++ ) all.push_back( std::make_pair( a[i], 0 ) );
+	for( size_t i = 0; i < b.size( ); i++ ) all.push_back( std::make_pair( b[i], 1 ) );
+	std::sort( all.begin( ), all.end( ) );
+
+	// Rank sum of a, ties sharing their mean rank
+	double r1 = 0., ties = 0.;
+	for( size_t i = 0; i < all.size( ); )
+	{
+		size_t j = i;
+		while( j < all.size( ) && all[j].first == all[i].first ) j++;
+
+		double t = j - i, rank = ( i + 1 + j ) / 2.;
+		for( size_t k = i; k < j; k++ )
+			if( all[k].second == 0 ) r1 += rank;
+		ties += t * t * t - t;
+		i = j;
+	}
+
+	double u = r1 - n1 * ( n1 + 1 ) / 2.;
+	double mu = n1 * n2 / 2.;
+	double sigma = sqrt( n1 * n2 / 12. * ( ( n + 1 ) - ties / ( n * ( n - 1 ) ) ) );
+	if( sigma == 0. ) return 1.;
+
+	double z = ( fabs( u - mu ) - 0.5 ) / sigma;
+	return z > 0. ? erfc( z / sqrt( 2. ) ) : 1.;
+}
+
+int main( int argc, char **argv )
+{
+	if( argc < 3 )
+	{
+		fprintf( stderr, "Try %s [alpha=0.05] [min=2] base new\n", argv[0] );
+		return 2;
+	}
+
+	Config cfg( argc - 2, argv );
+	double alpha = cfg.get( "alpha", 0.05 );
+	double minChange = cfg.get( "min", 2. );
+	if( !cfg.check( stderr ) ) return 2;
+
+	Side base, next;
+	if( !Load( argv[argc - 2], base ) || !Load( argv[argc - 1], next ) ) return 2;
+
+	// Every group of either side, in order
+	std::map<std::string, bool> keys;
+	for( Side::iterator it = base.begin( ); it != base.end( ); ++it ) keys[it->first] = true;
+	for( Side::iterator it = next.begin( ); it != next.end( ); ++it ) keys[it->first] = true;
+
+	int regressions = 0, improvements = 0, same = 0, unmatched = 0;
+
+	fprintf( stdout, "Benchmark,Config,Base Samples,New Samples,Base Median M/sec,New Median M/sec,Throughput Change %%,p,Verdict\n" );
+
+	for( std::map<std::string, bool>::iterator it = keys.begin( ); it != keys.end( ); ++it )
+	{
+		const std::string &key = it->first;
+		std::string bench = key.substr( 0, key.find( '\t' ) ), config = key.substr( key.find( '\t' ) + 1 );
+
+		Side::iterator b = base.find( key ), n = next.find( key );
+		size_t nb = b == base.end( ) ? 0 : b->second.samples.size( );
+		size_t nn = n == next.end( ) ? 0 : n->second.samples.size( );
+
+		fprintf( stdout, "%s,%s,%zu,%zu,", bench.c_str( ), config.c_str( ), nb, nn );
+
+		if( nb < MINSAMPLES || nn < MINSAMPLES )
+		{
+			if( nb > 0 ) fprintf( stdout, "%.9g,", Median( b->second.samples ) );
+			else fprintf( stdout, "," );
+			if( nn > 0 ) fprintf( stdout, "%.9g,,,", Median( n->second.samples ) );
+			else fprintf( stdout, ",,," );
+			fprintf( stdout, "%s\n", nb == 0 ? "only new" : nn == 0 ? "only base" : "too few samples" );
+			unmatched++;
+			continue;
+		}
+
+		const Group &gb = b->second, &gn = n->second;
+		if( gb.machine != gn.machine || gb.mixed || gn.mixed )
+			fprintf( stderr, "%s %s: not all runs on the same machine, compiler and flags\n", bench.c_str( ), config.c_str( ) );
+
+		double mb = Median( gb.samples ), mn = Median( gn.samples );
+		double change = mb > 0. ? ( mn / mb - 1. ) * 100. : 0.;
+		double p = MannWhitney( gb.samples, gn.samples );
+
+		const char *verdict = "no change";
+		if( p < alpha && change <= -minChange )
+		{
+			verdict = "regression";
+			regressions++;
+		}
+		else if( p < alpha && change >= minChange )
+		{
+			verdict = "improvement";
+			improvements++;
+		}
+		else same++;
+
+		fprintf( stdout, "%.9g,%.9g,%.2lf,%.4lf,%s\n", mb, mn, change, p, verdict );
+	}
+
+	fprintf( stderr, "%d regressions, %d improvements, %d unchanged, %d not compared\n",
+		regressions, improvements, same, unmatched );
+
+	return regressions > 0 ? 1 : 0;
+}
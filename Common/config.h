@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+/*	Runtime parameters, so one build can sweep what used to need a -D
+	recompile per data point.
+
+	Parameters are key=value words on the command line, after any getopt
+	options, or key=value lines in a file named by config=file. Blank lines
+	and everything after a # are ignored in files. Later settings win, so
+	command line values after config=file override the file.
+
+	The -D macros stay as the defaults:
+		int threads = cfg.get( "threads", NUMT );
+	and check( ) afterwards reports any word that was not key=value and
+	any key that no get( ) asked for, which catches typos.
+*/
+
+class Config
+{
+	public:
+		// Parses argv[first] to argv[argc-1]
+		Config( int argc, char **argv, int first = 1 )
+		{
+			for( int i = first; i < argc; i++ )
+				parse( argv[i], "command line" );
+		}
+
+		bool has( const char *key )
+		{
+			return find( key ) != NULL;
+		}
+
+		int get( const char *key, int fallback )
+		{
+			return (int) get( key, (long) fallback );
+		}
+
+		long get( const char *key, long fallback )
+		{
+			Entry *e = find( key );
+			if( e == NULL ) return fallback;
+
+			char *end;
+			double v = strtod( e->value.c_str( ), &end );	// accepts 1e6 as well as 1000000
+			if( end == e->value.c_str( ) || *end != '\0' ) bad( e, "a number" );
+			return (long) v;
+		}
+
+		double get( const char *key, double fallback )
+		{
+			Entry *e = find( key );
+			if( e == NULL ) return fallback;
+
+			char *end;
+			double v = strtod( e->value.c_str( ), &end );
+			if( end == e->value.c_str( ) || *end != '\0' ) bad( e, "a number" );
+			return v;
+		}
+
+		const char *get( const char *key, const char *fallback )
+		{
+			Entry *e = find( key );
+			return e == NULL ? fallback : e->value.c_str( );
+		}
+
+		// Index of key's value in names[0..n-1], which may also be given as the index itself
+		int choice( const char *key, const char *const *names, int n, int fallback )
+		{
+			Entry *e = find( key );
+			if( e == NULL ) return fallback;
+
+			for( int i = 0; i < n; i++ )
+				if( names[i][0] != '\0' && e->value == names[i] ) return i;
+
+			char *end;
+			long v = strtol( e->value.c_str( ), &end, 10 );
+			if( end != e->value.c_str( ) && *end == '\0' && v >= 0 && v < n && names[v][0] != '\0' ) return (int) v;
+
+			bad( e, "one of the listed names" );
+			return fallback;
+		}
+
+		/*	Prints every problem found so far to fp: words that were not
+			key=value, unreadable files, bad values and keys nobody read.
+			Returns true if there were none. */
+		bool check( FILE *fp )
+		{
+			for( size_t i = 0; i < entries.size( ); i++ )
+				if( !entries[i].used )
+					errors.push_back( "Unknown parameter " + entries[i].key + " (" + entries[i].from + ")" );
+
+			for( size_t i = 0; i < errors.size( ); i++ )
+				fprintf( fp, "%s\n", errors[i].c_str( ) );
+
+			return errors.empty( );
+		}
+
+	private:
+		struct Entry
+		{
+			std::string key, value, from;
+			bool used;
+		};
+
+		std::vector<Entry> entries;
+		std::vector<std::string> errors;
+
+		// The last setting of key, marked as read
+		Entry *find( const char *key )
+		{
+			Entry *last = NULL;
+			for( size_t i = 0; i < entries.size( ); i++ )
+			{
+				if( entries[i].key != key ) continue;
+				entries[i].used = true;
+				last = &entries[i];
+			}
+			return last;
+		}
+
+		void bad( const Entry *e, const char *want )
+		{
+			errors.push_back( "Bad value " + e->key + "=" + e->value + " (" + e->from + "): expected " + want );
+		}
+
+		void parse( const char *word, const std::string &from )
+		{
+			const char *eq = strchr( word, '=' );
+			if( eq == NULL || eq == word )
+			{
+				errors.push_back( std::string( "Expected key=value, got " ) + word + " (" + from + ")" );
+				return;
+			}
+
+			std::string key( word, eq - word ), value( eq + 1 );
+			Trim( key );
+			Trim( value );
+
+			if( key == "config" ) load( value );
+			else entries.push_back( Entry{ key, value, from, false } );
+		}
+
+		void load( const std::string &path )
+		{
+			FILE *fp = fopen( path.c_str( ), "r" );
+			if( fp == NULL )
+			{
+				errors.push_back( "Cannot open config file " + path );
+				return;
+			}
+
+			char line[1024];
+			for( int n = 1; fgets( line, sizeof(line), fp ) != NULL; n++ )
+			{
+				std::string s( line );
+				size_t hash = s.find( '#' );
+				if( hash != std::string::npos ) s.erase( hash );
+				Trim( s );
+				if( !s.empty( ) ) parse( s.c_str( ), path + ":" + std::to_string( n ) );
+			}
+
+			fclose( fp );
+		}
+
+		static void Trim( std::string &s )
+		{
+			const char *space = " \t\r\n";
+			s.erase( 0, s.find_first_not_of( space ) );
+			s.erase( s.find_last_not_of( space ) + 1 );
+		}
+};
+
+
+#endif		// CONFIG_H
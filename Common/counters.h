@@ -0,0 +1,288 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <vector>
+#include <omp.h>
+#ifdef __linux__
+	#include <sys/syscall.h>
+	#include <linux/perf_event.h>
+#endif
+
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+/*	Hardware performance counters through perf_event_open, so a slow
+	region can be explained and not only timed.
+
+	A Counters opens one counter per event on every thread of an OpenMP
+	team and accumulates what each thread counted between start( ) and
+	stop( ). Counters run in user mode only, which perf_event_paranoid 2
+	(the usual default) allows for one's own threads. When the kernel
+	multiplexes counters, counts are scaled by time enabled / time
+	running.
+
+	Thread t's counters follow the OS thread that was OpenMP thread t when
+	they were opened. libgomp keeps its pool, so that is thread t of later
+	teams of the same size; threads outside that team are not counted.
+
+	Nothing here fails hard: an event the CPU, kernel or VM does not offer
+	is left out, and its columns are printed empty.
+
+	Environment:
+		BENCH_COUNTERS		set to anything but 0 to count (see Bench::count)
+		BENCH_XFER_EVENT	raw event for cache-line transfers, which has no
+							generic perf event; e.g. 0x04d2 for
+							MEM_LOAD_L3_HIT_RETIRED.XSNP_HITM on Intel Skylake
+*/
+
+enum { CTR_CYCLES, CTR_INSTRUCTIONS, CTR_L1DMISS, CTR_LLCMISS, CTR_XFER, CTR_BRANCHMISS, NUMCOUNTERS };
+
+static const char *COUNTERNAMES[NUMCOUNTERS] = { "Cycles", "Instructions", "L1D Misses", "LLC Misses", "Line Transfers", "Branch Misses" };
+static const char *COUNTERKEYS[NUMCOUNTERS] = { "cycles", "instructions", "l1dMisses", "llcMisses", "lineTransfers", "branchMisses" };
+
+/* Mean counts per counted run; have[c] is false if event c was never counted */
+struct CounterSet
+{
+	double count[NUMCOUNTERS];
+	bool have[NUMCOUNTERS];
+
+	double ipc( ) const
+	{
+		return have[CTR_CYCLES] && have[CTR_INSTRUCTIONS] && count[CTR_CYCLES] > 0. ?
+			count[CTR_INSTRUCTIONS] / count[CTR_CYCLES] : 0.;
+	}
+};
+
+class Counters
+{
+	public:
+		// True if BENCH_COUNTERS asks for counters
+		static bool Enabled( )
+		{
+			const char *v = getenv( "BENCH_COUNTERS" );
+			return v != NULL && v[0] != '\0' && strcmp( v, "0" ) != 0;
+		}
+
+		// Opens the counters on every thread of a team of nthreads threads
+		Counters( int nthreads )
+			: nthreads( nthreads ), runs( 0 ), error( 0 ),
+			  fds( (size_t)nthreads * NUMCOUNTERS, -1 ), begin( fds.size( ) ), end( fds.size( ) ),
+			  total( fds.size( ), 0. ), counted( fds.size( ), false )
+		{
+			// Each thread keeps its own first errno; the lowest thread's is reported
+			std::vector<int> errors( nthreads, 0 );
+			#pragma omp parallel num_threads(nthreads)
+			{
+				int me = omp_get_thread_num( );
+				for( int c = 0; c < NUMCOUNTERS; c++ )
+				{
+					int fd = Open( c );
+					if( fd >= 0 ) fds[ (size_t)me * NUMCOUNTERS + c ] = fd;
+					else if( ( fd != -ENOENT || c != CTR_XFER ) && errors[me] == 0 ) errors[me] = -fd;	// no BENCH_XFER_EVENT is not an error
+				}
+			}
+			for( int t = 0; t < nthreads && error == 0; t++ )
+				error = errors[t];
+
+			// Once per process, so sweeps do not repeat it
+			static bool warned = false;
+			if( !available( ) && !warned )
+			{
+				fprintf( stderr, "Hardware counters unavailable (%s); counter columns left empty\n", strerror( error ) );
+				warned = true;
+			}
+		}
+
+		~Counters( )
+		{
+			for( size_t i = 0; i < fds.size( ); i++ )
+				if( fds[i] >= 0 ) close( fds[i] );
+		}
+
+		Counters( const Counters & ) = delete;
+		Counters &operator=( const Counters & ) = delete;
+
+		// True if any event could be opened
+		bool available( ) const
+		{
+			for( size_t i = 0; i < fds.size( ); i++ )
+				if( fds[i] >= 0 ) return true;
+			return false;
+		}
+
+		void start( )
+		{
+			Snapshot( begin );
+		}
+
+		// Adds what was counted since start( ) as one run
+		void stop( )
+		{
+			Snapshot( end );
+			for( size_t i = 0; i < fds.size( ); i++ )
+			{
+				uint64_t ran = end[i].running - begin[i].running;
+				if( fds[i] < 0 || ran == 0 ) continue;
+
+				double scale = (double)( end[i].enabled - begin[i].enabled ) / ran;
+				total[i] += ( end[i].value - begin[i].value ) * scale;
+				counted[i] = true;
+			}
+			runs++;
+		}
+
+		// Thread t's mean counts per run, or the sum over all threads for t = -1
+		CounterSet perRun( int t = -1 ) const
+		{
+			CounterSet s;
+			for( int c = 0; c < NUMCOUNTERS; c++ )
+			{
+				s.count[c] = 0.;
+				s.have[c] = false;
+				for( int i = t < 0 ? 0 : t; i < ( t < 0 ? nthreads : t + 1 ); i++ )
+				{
+					s.count[c] += total[ (size_t)i * NUMCOUNTERS + c ];
+					s.have[c] = s.have[c] || counted[ (size_t)i * NUMCOUNTERS + c ];
+				}
+				if( runs > 0 ) s.count[c] /= runs;
+			}
+			return s;
+		}
+
+		int threads( ) const { return nthreads; }
+
+		// CSV header fields, each name prefixed with prefix, to match columns( )
+		static void Header( FILE *fp, const char *prefix = "" )
+		{
+			for( int c = 0; c < NUMCOUNTERS; c++ )
+			{
+				fprintf( fp, ",%s%s", prefix, COUNTERNAMES[c] );
+				if( c == CTR_INSTRUCTIONS ) fprintf( fp, ",%sIPC", prefix );
+			}
+		}
+
+		// The fields of Header( ) with nothing counted
+		static void Blank( FILE *fp )
+		{
+			for( int c = 0; c <= NUMCOUNTERS; c++ )
+				fprintf( fp, "," );
+		}
+
+		// The fields of Header( ) for s, empty where an event is missing
+		static void Columns( FILE *fp, const CounterSet &s )
+		{
+			for( int c = 0; c < NUMCOUNTERS; c++ )
+			{
+				if( s.have[c] ) fprintf( fp, ",%.0lf", s.count[c] );
+				else fprintf( fp, "," );
+				if( c == CTR_INSTRUCTIONS )
+				{
+					if( s.ipc( ) > 0. ) fprintf( fp, ",%.3lf", s.ipc( ) );
+					else fprintf( fp, "," );
+				}
+			}
+		}
+
+		// All-thread counts per run as CSV fields
+		void columns( FILE *fp ) const
+		{
+			Columns( fp, perRun( ) );
+		}
+
+		// One line per thread and one for the sum, counts per run; nothing if no event opened
+		void print( FILE *fp, const char *name ) const
+		{
+			if( !available( ) ) return;
+
+			for( int t = -1; t < nthreads; t++ )
+			{
+				CounterSet s = perRun( t );
+				if( t < 0 ) fprintf( fp, "%s counters per run, all threads:", name );
+				else fprintf( fp, "  thread %2d:", t );
+
+				for( int c = 0; c < NUMCOUNTERS; c++ )
+					if( s.have[c] ) fprintf( fp, " %s %.0lf,", COUNTERKEYS[c], s.count[c] );
+				fprintf( fp, " ipc %.3lf\n", s.ipc( ) );
+			}
+		}
+
+		// Thread t's (or all threads', for t = -1) counts per run as a JSON object
+		void json( FILE *fp, int t = -1 ) const
+		{
+			CounterSet s = perRun( t );
+			fprintf( fp, "{" );
+			for( int c = 0; c < NUMCOUNTERS; c++ )
+			{
+				if( s.have[c] ) fprintf( fp, "\"%s\":%.17g,", COUNTERKEYS[c], s.count[c] );
+				else fprintf( fp, "\"%s\":null,", COUNTERKEYS[c] );
+			}
+			fprintf( fp, "\"ipc\":%.6g}", s.ipc( ) );
+		}
+
+	private:
+		// What read( ) returns with TOTAL_TIME_ENABLED | TOTAL_TIME_RUNNING
+		struct Reading
+		{
+			uint64_t value, enabled, running;
+		};
+
+		// A file descriptor counting event c on the calling thread, or -errno
+		static int Open( int c )
+		{
+			#ifdef __linux__
+				struct perf_event_attr a;
+				memset( &a, 0, sizeof(a) );
+				a.size = sizeof(a);
+				a.type = PERF_TYPE_HARDWARE;
+				a.exclude_kernel = 1;
+				a.exclude_hv = 1;
+				a.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+				switch( c )
+				{
+					case CTR_CYCLES:		a.config = PERF_COUNT_HW_CPU_CYCLES; break;
+					case CTR_INSTRUCTIONS:	a.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+					case CTR_LLCMISS:		a.config = PERF_COUNT_HW_CACHE_MISSES; break;
+					case CTR_BRANCHMISS:	a.config = PERF_COUNT_HW_BRANCH_MISSES; break;
+					case CTR_L1DMISS:
+						a.type = PERF_TYPE_HW_CACHE;
+						a.config = PERF_COUNT_HW_CACHE_L1D | ( PERF_COUNT_HW_CACHE_OP_READ << 8 ) | ( PERF_COUNT_HW_CACHE_RESULT_MISS << 16 );
+						break;
+					case CTR_XFER:
+					{
+						const char *raw = getenv( "BENCH_XFER_EVENT" );
+						if( raw == NULL || raw[0] == '\0' ) return -ENOENT;
+						a.type = PERF_TYPE_RAW;
+						a.config = strtoull( raw, NULL, 0 );
+						break;
+					}
+				}
+
+				int fd = (int) syscall( SYS_perf_event_open, &a, 0, -1, -1, 0 );
+				return fd >= 0 ? fd : -errno;
+			#else
+				return -ENOSYS;
+			#endif
+		}
+
+		void Snapshot( std::vector<Reading> &r )
+		{
+			for( size_t i = 0; i < fds.size( ); i++ )
+				if( fds[i] < 0 || read( fds[i], &r[i], sizeof(Reading) ) != (ssize_t) sizeof(Reading) )
+					r[i] = Reading{ 0, 0, 0 };
+		}
+
+		int nthreads;
+		int runs;						// stop( ) calls
+		int error;						// last errno from opening, for the warning
+		std::vector<int> fds;			// [thread*NUMCOUNTERS + event], -1 if not open
+		std::vector<Reading> begin, end;
+		std::vector<double> total;		// scaled counts summed over runs
+		std::vector<bool> counted;		// event ran on that thread in some run
+};
+
+
+#endif		// COUNTERS_H
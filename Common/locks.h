@@ -0,0 +1,208 @@
+#include <atomic>
+#include <cstddef>
+
+#ifndef LOCKS_H
+#define LOCKS_H
+
+/*	Spin locks, for critical sections too short to be worth putting a
+	thread to sleep over. Project 3/locks measures them against std::mutex
+	and omp_lock_t under contention.
+
+		TasLock		one flag, exchanged until it was clear; every try is a
+					write, so waiters keep taking the line from the holder
+		TtasLock	reads the flag until it looks clear and only then
+					exchanges, backing off exponentially after a lost race
+		TicketLock	takes a number and waits for it to be served: first
+					come, first served, but every waiter reads the one line
+					each handover writes
+		McsLock		a queue of per-thread nodes; each waiter spins on its
+					own node and the holder hands over to the next one
+					directly, so a handover moves one line whatever the
+					number of waiters. Fair, like the ticket lock
+
+	TasLock, TtasLock and TicketLock have lock( ), try_lock( ) and
+	unlock( ), so std::lock_guard and std::unique_lock take them. McsLock
+	needs a node per acquisition that lives until the unlock: use
+	McsLock::Guard, or lock( node ) and unlock( node ).
+
+	None of them is recursive, and a waiter spins for as long as it
+	waits: with more threads than CPUs, a descheduled holder (or, for the
+	fair locks, a descheduled next waiter) stalls everyone.
+*/
+
+// Destructive interference size each lock's hot words are padded to
+#ifndef LOCK_LINE
+	#define LOCK_LINE 64
+#endif
+
+// Pauses a TtasLock waits after its first lost race, doubled after each one up to BACKOFFMAX
+#ifndef BACKOFFMIN
+	#define BACKOFFMIN 4
+#endif
+
+#ifndef BACKOFFMAX
+	#define BACKOFFMAX 1024
+#endif
+
+// One pause of a spin loop: frees the pipeline for the other hardware thread of the core
+static inline void CpuRelax( )
+{
+	#if defined( __x86_64__ ) || defined( __i386__ )
+		__builtin_ia32_pause( );
+	#elif defined( __aarch64__ )
+		asm volatile( "yield" );
+	#endif
+}
+
+class alignas( LOCK_LINE ) TasLock
+{
+	public:
+		void lock( )
+		{
+			while( flag.exchange( true, std::memory_order_acquire ) )
+				CpuRelax( );
+		}
+
+		bool try_lock( )
+		{
+			return !flag.exchange( true, std::memory_order_acquire );
+		}
+
+		void unlock( )
+		{
+			flag.store( false, std::memory_order_release );
+		}
+
+	private:
+		std::atomic<bool> flag{ false };
+};
+
+class alignas( LOCK_LINE ) TtasLock
+{
+	public:
+		void lock( )
+		{
+			int backoff = BACKOFFMIN;
+			for( ;; )
+			{
+				while( flag.load( std::memory_order_relaxed ) )
+					CpuRelax( );
+				if( !flag.exchange( true, std::memory_order_acquire ) ) return;
+
+				// Lost the race to another waiter: let the winner's line settle
+				for( int i = 0; i < backoff; i++ )
+					CpuRelax( );
+				if( backoff < BACKOFFMAX ) backoff *= 2;
+			}
+		}
+
+		bool try_lock( )
+		{
+			return !flag.load( std::memory_order_relaxed ) && !flag.exchange( true, std::memory_order_acquire );
+		}
+
+		void unlock( )
+		{
+			flag.store( false, std::memory_order_release );
+		}
+
+	private:
+		std::atomic<bool> flag{ false };
+};
+
+class TicketLock
+{
+	public:
+		void lock( )
+		{
+			unsigned int mine = next.fetch_add( 1, std::memory_order_relaxed );
+			while( serving.load( std::memory_order_acquire ) != mine )
+				CpuRelax( );
+		}
+
+		bool try_lock( )
+		{
+			unsigned int now = serving.load( std::memory_order_relaxed );
+			unsigned int expected = now;
+			return next.compare_exchange_strong( expected, now + 1, std::memory_order_acquire, std::memory_order_relaxed );
+		}
+
+		// Only the holder writes serving, so it can read it plainly
+		void unlock( )
+		{
+			serving.store( serving.load( std::memory_order_relaxed ) + 1, std::memory_order_release );
+		}
+
+	private:
+		// Apart, so taking a number does not disturb the waiters reading serving
+		alignas( LOCK_LINE ) std::atomic<unsigned int> next{ 0 };
+		alignas( LOCK_LINE ) std::atomic<unsigned int> serving{ 0 };
+};
+
+class alignas( LOCK_LINE ) McsLock
+{
+	public:
+		// One waiter's place in the queue, on its own line
+		struct alignas( LOCK_LINE ) Node
+		{
+			std::atomic<Node *> next;
+			std::atomic<bool> waiting;
+		};
+
+		// Holds the lock for the guard's scope, with its node on the stack
+		class Guard
+		{
+			public:
+				explicit Guard( McsLock &lock ) : l( lock ) { l.lock( node ); }
+				~Guard( ) { l.unlock( node ); }
+
+				Guard( const Guard & ) = delete;
+				Guard &operator=( const Guard & ) = delete;
+
+			private:
+				McsLock &l;
+				Node node;
+		};
+
+		void lock( Node &me )
+		{
+			me.next.store( NULL, std::memory_order_relaxed );
+			me.waiting.store( true, std::memory_order_relaxed );
+
+			Node *prev = tail.exchange( &me, std::memory_order_acq_rel );
+			if( prev == NULL ) return;
+
+			prev->next.store( &me, std::memory_order_release );
+			while( me.waiting.load( std::memory_order_acquire ) )
+				CpuRelax( );
+		}
+
+		bool try_lock( Node &me )
+		{
+			me.next.store( NULL, std::memory_order_relaxed );
+			Node *none = NULL;
+			return tail.compare_exchange_strong( none, &me, std::memory_order_acq_rel, std::memory_order_relaxed );
+		}
+
+		void unlock( Node &me )
+		{
+			Node *succ = me.next.load( std::memory_order_acquire );
+			if( succ == NULL )
+			{
+				// No one queued behind us: empty the queue, unless someone joins it meanwhile
+				Node *expected = &me;
+				if( tail.compare_exchange_strong( expected, NULL, std::memory_order_release, std::memory_order_relaxed ) ) return;
+
+				// They swapped themselves in as the tail but have not linked to us yet
+				while( ( succ = me.next.load( std::memory_order_acquire ) ) == NULL )
+					CpuRelax( );
+			}
+			succ->waiting.store( false, std::memory_order_release );
+		}
+
+	private:
+		std::atomic<Node *> tail{ NULL };
+};
+
+
+#endif		// LOCKS_H
@@ -0,0 +1,127 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef PHILOX_H
+#define PHILOX_H
+
+/*	Philox4x32-10 counter-based random numbers (Salmon et al., SC'11).
+
+	A random value is a pure function of (seed, stream, draw): no state
+	is carried from one call to the next, so any thread can produce any
+	part of any stream, in any order, and always get the same numbers.
+	Give every body, simulation or cell its own stream and number its
+	draws, and results cannot depend on the thread count.
+
+	Draw d of a stream is lane d % 4 of block d / 4, where one block is
+	one Philox4x32 call with counter { d/4 low, d/4 high, stream, 0 } and
+	key { seed, PHILOX_SALT }. PhiloxUniform, PhiloxBlock and PhiloxFill
+	all use that numbering, so they agree with each other.
+
+	Everything is integer multiply, xor and shift on 32-bit lanes with
+	no branches, so loops calling these under #pragma omp simd vectorize.
+	PhiloxFill is such a loop over blocks.
+*/
+
+#define PHILOX_M0		0xD2511F53u
+#define PHILOX_M1		0xCD9E8D57u
+#define PHILOX_W0		0x9E3779B9u
+#define PHILOX_W1		0xBB67AE85u
+#define PHILOX_ROUNDS	10
+
+// Second key word; seeds are 32 bits
+#define PHILOX_SALT		0x5851F42Du
+
+// Top 24 bits of x as a float in [0,1)
+static inline float PhiloxU01( uint32_t x )
+{
+	return (float)( x >> 8 ) * ( 1.f / 16777216.f );
+}
+
+// The Philox4x32-10 bijection: out = ctr encrypted under key
+static inline void Philox4x32( const uint32_t ctr[4], const uint32_t key[2], uint32_t out[4] )
+{
+	uint32_t c0 = ctr[0], c1 = ctr[1], c2 = ctr[2], c3 = ctr[3];
+	uint32_t k0 = key[0], k1 = key[1];
+
+	for( int r = 0; r < PHILOX_ROUNDS; r++ )
+	{
+		uint64_t p0 = (uint64_t)PHILOX_M0 * c0;
+		uint64_t p1 = (uint64_t)PHILOX_M1 * c2;
+
+		uint32_t n0 = (uint32_t)( p1 >> 32 ) ^ c1 ^ k0;
+		uint32_t n2 = (uint32_t)( p0 >> 32 ) ^ c3 ^ k1;
+		c1 = (uint32_t) p1;
+		c3 = (uint32_t) p0;
+		c0 = n0;
+		c2 = n2;
+
+		k0 += PHILOX_W0;
+		k1 += PHILOX_W1;
+	}
+
+	out[0] = c0;	out[1] = c1;	out[2] = c2;	out[3] = c3;
+}
+
+// Draws 4*block to 4*block+3 of (seed, stream) as floats in [0,1)
+static inline void PhiloxBlock( uint32_t seed, uint32_t stream, uint64_t block, float u[4] )
+{
+	uint32_t ctr[4] = { (uint32_t) block, (uint32_t)( block >> 32 ), stream, 0 };
+	uint32_t key[2] = { seed, PHILOX_SALT };
+	uint32_t x[4];
+
+	Philox4x32( ctr, key, x );
+
+	for( int l = 0; l < 4; l++ )
+		u[l] = PhiloxU01( x[l] );
+}
+
+// PhiloxBlock scaled to [low, low + scale) and stored to o[0..3]
+static inline void PhiloxBlockScaled( uint32_t seed, uint32_t stream, uint64_t block, float low, float scale, float *o )
+{
+	float u[4];
+	PhiloxBlock( seed, stream, block, u );
+
+	o[0] = low + scale * u[0];
+	o[1] = low + scale * u[1];
+	o[2] = low + scale * u[2];
+	o[3] = low + scale * u[3];
+}
+
+// Draw number draw of (seed, stream), in [0,1)
+static inline float PhiloxUniform( uint32_t seed, uint32_t stream, uint64_t draw )
+{
+	float u[4];
+	PhiloxBlock( seed, stream, draw >> 2, u );
+
+	// Select without indexing so the call still vectorizes
+	int lane = (int)( draw & 3 );
+	return lane == 0 ? u[0] : lane == 1 ? u[1] : lane == 2 ? u[2] : u[3];
+}
+
+/*	Batch API: out[i] = draw first + i of (seed, stream), scaled to
+	[low, high), for i < n. Whole blocks run as one vector loop; only a
+	ragged start or end falls back to single draws. */
+static inline void PhiloxFill( uint32_t seed, uint32_t stream, uint64_t first, float *out, size_t n, float low, float high )
+{
+	float scale = high - low;
+	size_t i = 0;
+
+	// Up to the first block boundary
+	for( ; i < n && ( ( first + i ) & 3 ) != 0; i++ )
+		out[i] = low + scale * PhiloxUniform( seed, stream, first + i );
+
+	size_t blocks = ( n - i ) / 4;
+	uint64_t b0 = ( first + i ) >> 2;
+	float *o = out + i;
+
+	// No arrays declared in the loop body: gcc will not vectorize omp simd private arrays
+	#pragma omp simd
+	for( size_t b = 0; b < blocks; b++ )
+		PhiloxBlockScaled( seed, stream, b0 + b, low, scale, &o[4*b] );
+
+	for( i += 4 * blocks; i < n; i++ )
+		out[i] = low + scale * PhiloxUniform( seed, stream, first + i );
+}
+
+
+#endif		// PHILOX_H
@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#ifndef RESULTS_H
+#define RESULTS_H
+
+/*	Reading the JSON results store that Common/bench.h appends to
+	(BENCH_OUT=file.json), for the tools that analyse it.
+
+	A store is one JSON record per line. Records are picked with a spec,
+	file or file@tag, the latter keeping only those written with
+	BENCH_TAG=tag. The field readers only understand the flat records
+	bench.h writes, not JSON in general.
+*/
+
+class Results
+{
+	public:
+		// The records of spec (file or file@tag); false if the file cannot be read
+		static bool Read( const char *spec, std::vector<std::string> &records )
+		{
+			std::string path( spec ), tag;
+			size_t at = path.rfind( '@' );
+			bool tagged = at != std::string::npos;
+			if( tagged )
+			{
+				tag = path.substr( at + 1 );
+				path.erase( at );
+			}
+
+			FILE *fp = fopen( path.c_str( ), "r" );
+			if( fp == NULL )
+			{
+				perror( path.c_str( ) );
+				return false;
+			}
+
+			// Records carry every sample, so lines can be long
+			std::vector<char> line( 1 << 20 );
+			while( fgets( line.data( ), (int) line.size( ), fp ) != NULL )
+			{
+				const char *rec = line.data( );
+				if( rec[0] != '{' ) continue;
+				if( tagged && Field( rec, "tag" ) != tag ) continue;
+				records.push_back( rec );
+			}
+
+			fclose( fp );
+			return true;
+		}
+
+		// The string value of key in a record, or "" if missing
+		static std::string Field( const std::string &rec, const char *key )
+		{
+			std::string pat = std::string( "\"" ) + key + "\":\"";
+			size_t at = rec.find( pat );
+			std::string value;
+			if( at == std::string::npos ) return value;
+
+			for( const char *p = rec.c_str( ) + at + pat.size( ); *p != '\0' && *p != '"'; p++ )
+			{
+				if( *p == '\\' && p[1] != '\0' ) p++;
+				value += *p;
+			}
+			return value;
+		}
+
+		// The number value of key in a record, or 0 if missing
+		static double Number( const std::string &rec, const char *key )
+		{
+			std::string pat = std::string( "\"" ) + key + "\":";
+			size_t at = rec.find( pat );
+			return at == std::string::npos ? 0. : atof( rec.c_str( ) + at + pat.size( ) );
+		}
+
+		// The numbers of the array value of key in a record
+		static std::vector<double> Numbers( const std::string &rec, const char *key )
+		{
+			std::string pat = std::string( "\"" ) + key + "\":[";
+			size_t at = rec.find( pat );
+			std::vector<double> v;
+			if( at == std::string::npos ) return v;
+
+			const char *p = rec.c_str( ) + at + pat.size( );
+			while( *p != ']' && *p != '\0' )
+			{
+				char *end;
+				double x = strtod( p, &end );
+				if( end == p ) break;
+				v.push_back( x );
+				p = *end == ',' ? end + 1 : end;
+			}
+			return v;
+		}
+
+		// Every timed sample as a throughput, work over time, in the units of the projects' CSV (M/sec)
+		static std::vector<double> Throughputs( const std::string &rec )
+		{
+			std::vector<double> samples = Numbers( rec, "samples" );
+			double work = Number( rec, "work" );
+			for( size_t i = 0; i < samples.size( ); i++ )
+				samples[i] = samples[i] > 0. && work > 0. ? work / samples[i] / 1000000. : 0.;
+			return samples;
+		}
+
+		// The record's median throughput (M/sec)
+		static double Throughput( const std::string &rec )
+		{
+			double median = Number( rec, "median" ), work = Number( rec, "work" );
+			return median > 0. && work > 0. ? work / median / 1000000. : 0.;
+		}
+
+		/*	The record's config, with " place=policy" added for pinned runs so
+			they are never pooled with unpinned ones; records without a
+			placement were not pinned */
+		static std::string Config( const std::string &rec )
+		{
+			std::string config = Field( rec, "config" ), place = Field( rec, "placement" );
+			place = place.substr( 0, place.find( ' ' ) );
+			if( !place.empty( ) && place != "none" ) config += " place=" + place;
+			return config;
+		}
+
+		// Host, CPU, compiler and flags: runs that differ here are not comparable
+		static std::string Machine( const std::string &rec )
+		{
+			return Field( rec, "host" ) + " / " + Field( rec, "cpu" ) + " / " +
+				Field( rec, "compiler" ) + " / " + Field( rec, "flags" );
+		}
+};
+
+
+#endif		// RESULTS_H
@@ -0,0 +1,102 @@
+#define _GNU_SOURCE	// rand_r
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <omp.h>
+#include "philox.h"
+
+/*	Random float throughput against thread count. Every thread fills its
+	own slice of one array of COUNT floats:
+
+	rand_r	one rand_r seed per thread, what proj4 used to do
+	philox	PhiloxUniform one draw at a time, draw i of stream 0
+	fill	PhiloxFill over the slice, the vectorized batch path
+
+	The Philox rows also check the array matches a one-thread run, since
+	draw i of the array depends only on i. rand_r's array changes with
+	the thread count, which is the problem being fixed.
+
+	Run as: rngbench [maxthreads]
+	Output (CSV): Generator,Threads,Mfloats/sec,Same as 1 thread
+*/
+
+#ifndef COUNT
+	#define COUNT 50000000
+#endif
+
+#define SEED 12345u
+
+enum { RANDR, PHILOX, FILL, NUMGENS };
+
+const char *GENNAMES[NUMGENS] = { "rand_r", "philox", "fill" };
+
+// Fills a[0..COUNT-1] with generator gen on threads threads; returns seconds
+double Generate( int gen, float *a, int threads )
+{
+	double tStart = omp_get_wtime( );
+
+	#pragma omp parallel num_threads(threads)
+	{
+		int me = omp_get_thread_num( );
+		size_t lo = (size_t)COUNT * me / threads;
+		size_t hi = (size_t)COUNT * ( me + 1 ) / threads;
+
+		switch( gen )
+		{
+			case RANDR:
+			{
+				unsigned int seed = SEED + me;
+				for( size_t i = lo; i < hi; i++ )
+					a[i] = (float) rand_r( &seed ) / (float) RAND_MAX;
+				break;
+			}
+
+			case PHILOX:
+				for( size_t i = lo; i < hi; i++ )
+					a[i] = PhiloxUniform( SEED, 0, i );
+				break;
+
+			case FILL:
+				PhiloxFill( SEED, 0, lo, &a[lo], hi - lo, 0.f, 1.f );
+				break;
+		}
+	}
+
+	return omp_get_wtime( ) - tStart;
+}
+
+int main( int argc, char **argv )
+{
+	int maxThreads = argc > 1 ? atoi( argv[1] ) : omp_get_num_procs( );
+
+	float *a = (float *) malloc( COUNT * sizeof(float) );
+	float *ref = (float *) malloc( COUNT * sizeof(float) );
+
+	// Fault the pages in now so the first run does not pay for them
+	memset( a, 0, COUNT * sizeof(float) );
+
+	fprintf( stdout, "Generator,Threads,Mfloats/sec,Same as 1 thread\n" );
+
+	for( int gen = 0; gen < NUMGENS; gen++ )
+	{
+		for( int threads = 1; threads <= maxThreads; threads++ )
+		{
+			double t = Generate( gen, a, threads );
+			if( threads == 1 )
+				for( size_t i = 0; i < COUNT; i++ ) ref[i] = a[i];
+
+			bool same = true;
+			for( size_t i = 0; i < COUNT && same; i++ )
+				same = a[i] == ref[i];
+
+			fprintf( stdout, "%s,%d,%lf,%s\n", GENNAMES[gen], threads, COUNT / t / 1000000., same ? "yes" : "no" );
+			fflush( stdout );
+		}
+	}
+
+	free( a );
+	free( ref );
+
+	return EXIT_SUCCESS;
+}
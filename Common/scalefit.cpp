@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include "config.h"
+#include "results.h"
+#include "scaling.h"
+
+/*	Fits Amdahl, Gustafson and USL models (scaling.h) to every thread-count
+	sweep in the JSON results store that Common/bench.h appends to
+	(BENCH_OUT=file.json), and predicts each sweep's best thread count.
+
+	A sweep is the runs of one benchmark whose configurations differ only
+	in threads=N, so proj1 at every node count or proj3 at every fix and
+	pad is a sweep of its own; pinned runs are apart by placement policy.
+	A run's speedup is its median throughput over the median of the
+	sweep's one-thread runs, so a sweep needs threads=1 and at least one
+	more thread count. Runs on different machines, compilers or flags are
+	warned about, as with benchcmp.
+
+	Run as: scalefit [benchmark=name] results
+		results		file or file@tag: the records of a store, or only those
+					written with BENCH_TAG=tag
+
+	e.g. ./script3; scalefit ../results.json
+
+	Output (CSV): Benchmark,Config, then Scaling::Header( ) ; one summary per
+		sweep goes to stderr.
+	Exit status: 0, 2 on bad arguments or files.
+*/
+
+/* The runs of one sweep */
+struct Sweep
+{
+	std::map<int, std::vector<double> > rates;	// median M/sec of each run, by threads
+	std::string machine;	// host, cpu, compiler and flags of the first run
+	bool mixed = false;		// later runs had a different machine
+};
+
+/*	Splits config at its threads=N word: the rest is returned, N goes in
+	threads. Returns config unchanged and threads 0 if there is none. */
+static std::string WithoutThreads( const std::string &config, int &threads )
+{
+	threads = 0;
+	for( size_t at = 0; at < config.size( ); )
+	{
+		size_t end = config.find( ' ', at );
+		if( config.compare( at, 8, "threads=" ) == 0 )
+		{
+			threads = atoi( config.c_str( ) + at + 8 );
+
+			// Drops the word and one space next to it
+			if( end != std::string::npos ) return config.substr( 0, at ) + config.substr( end + 1 );
+			return config.substr( 0, at > 0 ? at - 1 : 0 );
+		}
+
+		// Next word, past the space, so leading and doubled spaces end too
+		if( end == std::string::npos ) break;
+		at = end + 1;
+	}
+	return config;
+}
+
+static double Median( std::vector<double> x )
+{
+	std::sort( x.begin( ), x.end( ) );
+	size_t n = x.size( );
+	return n % 2 ? x[n / 2] : ( x[n / 2 - 1] + x[n / 2] ) / 2.;
+}
+
+int main( int argc, char **argv )
+{
+	if( argc < 2 )
+	{
+		fprintf( stderr, "Try %s [benchmark=name] results\n", argv[0] );
+		return 2;
+	}
+
+	Config cfg( argc - 1, argv );
+	std::string only = cfg.get( "benchmark", "" );
+	if( !cfg.check( stderr ) ) return 2;
+
+	std::vector<std::string> records;
+	if( !Results::Read( argv[argc - 1], records ) ) return 2;
+
+	std::map<std::string, Sweep> sweeps;	// by "benchmark\tconfig without threads"
+	for( size_t i = 0; i < records.size( ); i++ )
+	{
+		const std::string &rec = records[i];
+		std::string bench = Results::Field( rec, "benchmark" );
+		if( !only.empty( ) && bench != only ) continue;
+
+		int threads;
+		std::string config = WithoutThreads( Results::Config( rec ), threads );
+		double rate = Results::Throughput( rec );
+		if( threads < 1 || rate <= 0. ) continue;
+
+		Sweep &sw = sweeps[ bench + "\t" + config ];
+		std::string machine = Results::Machine( rec );
+		if( sw.rates.empty( ) ) sw.machine = machine;
+		else if( sw.machine != machine ) sw.mixed = true;
+		sw.rates[threads].push_back( rate );
+	}
+
+	int fitted = 0, skipped = 0;
+
+	fprintf( stdout, "Benchmark,Config," );
+	Scaling::Header( stdout );
+	fprintf( stdout, "\n" );
+
+	for( std::map<std::string, Sweep>::iterator it = sweeps.begin( ); it != sweeps.end( ); ++it )
+	{
+		const std::string &key = it->first;
+		std::string bench = key.substr( 0, key.find( '\t' ) ), config = key.substr( key.find( '\t' ) + 1 );
+		const Sweep &sw = it->second;
+		std::string name = bench + ( config.empty( ) ? "" : " " + config );
+
+		if( sw.rates.find( 1 ) == sw.rates.end( ) || sw.rates.size( ) < 2 )
+		{
+			skipped++;
+			continue;
+		}
+		if( sw.mixed ) fprintf( stderr, "%s: not all runs on the same machine, compiler and flags\n", name.c_str( ) );
+
+		double base = Median( sw.rates.find( 1 )->second );
+		Scaling scaling;
+		for( std::map<int, std::vector<double> >::const_iterator r = sw.rates.begin( ); r != sw.rates.end( ); ++r )
+			for( size_t j = 0; j < r->second.size( ); j++ )
+				scaling.add( r->first, r->second[j] / base );
+		scaling.fit( );
+
+		fprintf( stdout, "%s,%s,", bench.c_str( ), config.c_str( ) );
+		scaling.columns( stdout );
+		fprintf( stdout, "\n" );
+		scaling.print( stderr, name.c_str( ) );
+		fitted++;
+	}
+
+	fprintf( stderr, "%d sweeps fitted, %d without a one-thread run and another thread count\n", fitted, skipped );
+	return 0;
+}
@@ -0,0 +1,296 @@
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+
+#ifndef SCALING_H
+#define SCALING_H
+
+/*	Scalability models fitted to a thread-count sweep, to tell how far a
+	program will scale and what stops it.
+
+	Points are a thread count N and the speedup S at N threads over one
+	thread, taken from throughput, so a sweep whose work grows with N
+	(weak scaling) gives the scaled speedup. The models:
+
+		Amdahl		S = 1 / ( 1 - p + p/N )		p: parallel fraction of a fixed
+												amount of work
+		Gustafson	S = 1 - p + pN				p: parallel fraction of work
+												that grows with N
+		USL			S = N / ( 1 + s(N-1) + kN(N-1) )
+												s: contention, serialized work
+												k: coherency, the cost of every
+												thread talking to every other
+
+	Each is fitted by least squares on its linear form,
+		1 - 1/S = p (1 - 1/N)		S - 1 = p (N - 1)
+		N/S - 1 = s (N-1) + k N(N-1)
+	which gives standard errors for the parameters; RMSE is of the fitted
+	speedups. A negative or vanishing k is refitted with k = 0, as is the
+	USL with fewer than 3 points, which cannot fit two parameters with a
+	residual left over. A standard error needs one point more than the
+	parameters fitted, and is n/a otherwise. One-thread points are the
+	baseline and are not fitted.
+
+	The USL peaks at N* = sqrt( (1 - s) / k ) threads; with k = 0 it never
+	peaks and approaches 1/s, like Amdahl's 1/(1 - p). Contention is
+	flagged when s is at least CONTENTION and two standard errors above 0,
+	coherency when k is at least COHERENCY and two standard errors above
+	0: the latter is the retrograde scaling of false sharing (proj3).
+*/
+
+// Smallest contention s worth flagging
+#ifndef CONTENTION
+	#define CONTENTION	0.01
+#endif
+
+// Smallest coherency k worth flagging
+#ifndef COHERENCY
+	#define COHERENCY	0.0001
+#endif
+
+/* Fitted models of one sweep; NAN where too few points to tell */
+struct ScalingFit
+{
+	int points;				// fitted, thread counts above 1
+	int maxThreads;
+	double maxSpeedup;		// measured
+
+	double amdahl, amdahlSE, amdahlRMSE;
+	double gustafson, gustafsonSE, gustafsonRMSE;
+	double sigma, sigmaSE, kappa, kappaSE, uslRMSE;
+
+	int best;				// USL's best thread count, 0 if it never peaks
+	double bestSpeedup;		// USL speedup there, or its limit; INFINITY if unbounded
+
+	bool contention, coherency;
+};
+
+class Scaling
+{
+	public:
+		// A measured speedup at threads threads; several per thread count are fine
+		void add( int threads, double speedup )
+		{
+			if( threads > 1 && speedup > 0. )
+			{
+				n.push_back( threads );
+				s.push_back( speedup );
+			}
+		}
+
+		int points( ) const { return (int) n.size( ); }
+
+		/*	Fits all three models; with no points above one thread every
+			parameter is NAN */
+		const ScalingFit &fit( )
+		{
+			ScalingFit &f = result;
+			f.points = points( );
+			f.maxThreads = 1;
+			f.maxSpeedup = 1.;
+			for( int i = 0; i < f.points; i++ )
+			{
+				if( n[i] > f.maxThreads ) f.maxThreads = n[i];
+				if( s[i] > f.maxSpeedup ) f.maxSpeedup = s[i];
+			}
+
+			std::vector<double> x( f.points ), y( f.points ), x2( f.points );
+
+			// Amdahl
+			for( int i = 0; i < f.points; i++ )
+			{
+				x[i] = 1. - 1. / n[i];
+				y[i] = 1. - 1. / s[i];
+			}
+			Origin( x, y, f.amdahl, f.amdahlSE );
+			f.amdahlRMSE = Rmse( [&]( double N ) { return 1. / ( 1. - f.amdahl + f.amdahl / N ); } );
+
+			// Gustafson
+			for( int i = 0; i < f.points; i++ )
+			{
+				x[i] = n[i] - 1.;
+				y[i] = s[i] - 1.;
+			}
+			Origin( x, y, f.gustafson, f.gustafsonSE );
+			f.gustafsonRMSE = Rmse( [&]( double N ) { return 1. - f.gustafson + f.gustafson * N; } );
+
+			// USL
+			for( int i = 0; i < f.points; i++ )
+			{
+				x[i] = n[i] - 1.;
+				x2[i] = (double) n[i] * ( n[i] - 1. );
+				y[i] = n[i] / s[i] - 1.;
+			}
+			bool fitted = Origin2( x, x2, y, f.sigma, f.sigmaSE, f.kappa, f.kappaSE );
+			if( !fitted || f.kappa * f.maxThreads * ( f.maxThreads - 1. ) < 1e-9 )	// negative, or round-off
+			{
+				f.kappa = f.points > 0 ? 0. : NAN;
+				f.kappaSE = NAN;
+				Origin( x, y, f.sigma, f.sigmaSE );
+			}
+			f.uslRMSE = Rmse( [&]( double N ) { return Usl( N ); } );
+
+			// Where the USL peaks, tried at the whole thread counts either side of N*
+			f.best = 0;
+			f.bestSpeedup = NAN;
+			if( f.points > 0 && f.kappa > 0. )
+			{
+				double peak = f.sigma < 1. ? sqrt( ( 1. - f.sigma ) / f.kappa ) : 1.;
+				int lo = peak < 1. ? 1 : (int) floor( peak );
+				f.best = Usl( lo + 1 ) > Usl( lo ) ? lo + 1 : lo;
+				f.bestSpeedup = Usl( f.best );
+			}
+			else if( f.points > 0 ) f.bestSpeedup = f.sigma > 0. ? 1. / f.sigma : INFINITY;
+
+			f.contention = f.sigma >= CONTENTION && f.sigma > 2. * f.sigmaSE;
+			f.coherency = f.kappa >= COHERENCY && f.kappa > 2. * f.kappaSE;
+			return f;
+		}
+
+		// CSV header fields to match columns( )
+		static void Header( FILE *fp )
+		{
+			fprintf( fp, "Points,Max Threads,Max Speedup,Amdahl p,Amdahl SE,Amdahl RMSE,Gustafson p,Gustafson SE,Gustafson RMSE," );
+			fprintf( fp, "USL Sigma,USL Sigma SE,USL Kappa,USL Kappa SE,USL RMSE,Best Threads,Best Speedup,Flags" );
+		}
+
+		// The fields of Header( ) for the last fit( ), empty where unknown
+		void columns( FILE *fp ) const
+		{
+			const ScalingFit &f = result;
+			fprintf( fp, "%d,%d,%.4lf", f.points, f.maxThreads, f.maxSpeedup );
+			Field( fp, f.amdahl, "%.6lf" );
+			Field( fp, f.amdahlSE, "%.6lf" );
+			Field( fp, f.amdahlRMSE, "%.4lf" );
+			Field( fp, f.gustafson, "%.6lf" );
+			Field( fp, f.gustafsonSE, "%.6lf" );
+			Field( fp, f.gustafsonRMSE, "%.4lf" );
+			Field( fp, f.sigma, "%.6lf" );
+			Field( fp, f.sigmaSE, "%.6lf" );
+			Field( fp, f.kappa, "%.8lf" );
+			Field( fp, f.kappaSE, "%.8lf" );
+			Field( fp, f.uslRMSE, "%.4lf" );
+			if( f.best > 0 ) fprintf( fp, ",%d", f.best );
+			else fprintf( fp, "," );
+			Field( fp, f.bestSpeedup, "%.4lf" );
+			fprintf( fp, ",%s%s%s", f.contention ? "contention" : "", f.contention && f.coherency ? " " : "",
+				f.coherency ? "coherency" : "" );
+		}
+
+		// A few human-readable lines for the last fit( )
+		void print( FILE *fp, const char *name ) const
+		{
+			const ScalingFit &f = result;
+			if( f.points == 0 )
+			{
+				fprintf( fp, "%s scaling: no thread counts above 1 to fit\n", name );
+				return;
+			}
+
+			fprintf( fp, "%s scaling, %d points up to %d threads, best measured speedup %.2lf:\n",
+				name, f.points, f.maxThreads, f.maxSpeedup );
+			fprintf( fp, "  Amdahl     p " );
+			PlusMinus( fp, f.amdahl, f.amdahlSE, 4 );
+			fprintf( fp, ", rmse %.3lf, limit %.1lf\n", f.amdahlRMSE, 1. / ( 1. - f.amdahl ) );
+			fprintf( fp, "  Gustafson  p " );
+			PlusMinus( fp, f.gustafson, f.gustafsonSE, 4 );
+			fprintf( fp, ", rmse %.3lf\n", f.gustafsonRMSE );
+			fprintf( fp, "  USL        sigma " );
+			PlusMinus( fp, f.sigma, f.sigmaSE, 4 );
+			fprintf( fp, ", kappa " );
+			PlusMinus( fp, f.kappa, f.kappaSE, 6 );
+			fprintf( fp, ", rmse %.3lf\n", f.uslRMSE );
+			if( f.best > 0 ) fprintf( fp, "  peaks at %d thread%s, speedup %.2lf", f.best, f.best == 1 ? "" : "s", f.bestSpeedup );
+			else fprintf( fp, "  never peaks, speedup approaches %.1lf", f.bestSpeedup );
+			fprintf( fp, "%s%s\n", f.contention ? "; contention" : "", f.coherency ? "; coherency costs" : "" );
+		}
+
+	private:
+		// USL speedup of the last fit at N threads
+		double Usl( double N ) const
+		{
+			return N / ( 1. + result.sigma * ( N - 1. ) + result.kappa * N * ( N - 1. ) );
+		}
+
+		// Root mean square error of model's speedups at the points
+		template<typename F> double Rmse( F model ) const
+		{
+			if( n.empty( ) ) return NAN;
+			double sum = 0.;
+			for( size_t i = 0; i < n.size( ); i++ )
+				sum += ( model( n[i] ) - s[i] ) * ( model( n[i] ) - s[i] );
+			return sqrt( sum / n.size( ) );
+		}
+
+		// Least squares b of y = b x, and its standard error
+		static void Origin( const std::vector<double> &x, const std::vector<double> &y, double &b, double &se )
+		{
+			double sxx = 0., sxy = 0.;
+			for( size_t i = 0; i < x.size( ); i++ )
+			{
+				sxx += x[i] * x[i];
+				sxy += x[i] * y[i];
+			}
+			b = sxx > 0. ? sxy / sxx : NAN;
+			se = NAN;
+			if( x.size( ) < 2 || !( sxx > 0. ) ) return;
+
+			double rss = 0.;
+			for( size_t i = 0; i < x.size( ); i++ )
+				rss += ( y[i] - b * x[i] ) * ( y[i] - b * x[i] );
+			se = sqrt( rss / ( x.size( ) - 1 ) / sxx );
+		}
+
+		// Least squares b1, b2 of y = b1 x1 + b2 x2, and their standard errors; false if singular
+		static bool Origin2( const std::vector<double> &x1, const std::vector<double> &x2, const std::vector<double> &y,
+			double &b1, double &se1, double &b2, double &se2 )
+		{
+			double a = 0., b = 0., c = 0., d = 0., e = 0.;
+			for( size_t i = 0; i < y.size( ); i++ )
+			{
+				a += x1[i] * x1[i];
+				b += x1[i] * x2[i];
+				c += x2[i] * x2[i];
+				d += x1[i] * y[i];
+				e += x2[i] * y[i];
+			}
+			double det = a * c - b * b;
+			if( y.size( ) < 3 || !( det > 1e-12 * a * c ) ) return false;
+
+			b1 = ( c * d - b * e ) / det;
+			b2 = ( a * e - b * d ) / det;
+
+			double rss = 0.;
+			for( size_t i = 0; i < y.size( ); i++ )
+			{
+				double r = y[i] - b1 * x1[i] - b2 * x2[i];
+				rss += r * r;
+			}
+			double var = rss / ( y.size( ) - 2 );
+			se1 = sqrt( var * c / det );
+			se2 = sqrt( var * a / det );
+			return true;
+		}
+
+		// "value +- se" to digits places, "+- n/a" where there is no standard error
+		static void PlusMinus( FILE *fp, double value, double se, int digits )
+		{
+			fprintf( fp, "%.*lf +- ", digits, value );
+			if( isfinite( se ) ) fprintf( fp, "%.*lf", digits, se );
+			else fprintf( fp, "n/a" );
+		}
+
+		// ",value" in fmt, or "," if value is unknown
+		static void Field( FILE *fp, double value, const char *fmt )
+		{
+			fprintf( fp, "," );
+			if( isfinite( value ) ) fprintf( fp, fmt, value );
+		}
+
+		std::vector<int> n;			// thread counts
+		std::vector<double> s;		// speedups
+		ScalingFit result{ };
+};
+
+
+#endif		// SCALING_H
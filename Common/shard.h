@@ -0,0 +1,63 @@
+#include <atomic>
+#include <cstddef>
+
+#ifndef SHARD_H
+#define SHARD_H
+
+// Destructive interference size we pad to. 64 on every x86 we run on.
+#define SHARD_LINE 64
+
+/*	Per-thread sharded accumulator (counter or sum).
+
+	Each thread owns one slot on its own cache line and is its only writer,
+	so add() is a plain relaxed load/store with no read-modify-write and no
+	line ever bounces between writers. read() walks every slot, so reads
+	cost one line transfer per thread: use it where writes far outnumber reads.
+*/
+template <typename T>
+class Sharded
+{
+	public:
+		explicit Sharded( int nslots ) : n( nslots ), slots( new Slot[ nslots ] ) { reset( ); }
+		~Sharded( ) { delete [] slots; }
+
+		Sharded( const Sharded & ) = delete;
+		Sharded &operator=( const Sharded & ) = delete;
+
+		// Adds x to slot; only the thread that owns slot may call this
+		void add( int slot, T x )
+		{
+			std::atomic<T> &v = slots[ slot ].value;
+			v.store( v.load( std::memory_order_relaxed ) + x, std::memory_order_relaxed );
+		}
+
+		// Sum of all slots; concurrent adds may or may not be included
+		T read( ) const
+		{
+			T sum = T( );
+			for( int i = 0; i < n; i++ )
+				sum += slots[ i ].value.load( std::memory_order_relaxed );
+			return sum;
+		}
+
+		// Zeroes every slot; not safe while other threads are adding
+		void reset( )
+		{
+			for( int i = 0; i < n; i++ )
+				slots[ i ].value.store( T( ), std::memory_order_relaxed );
+		}
+
+		int size( ) const { return n; }
+
+	private:
+		struct alignas( SHARD_LINE ) Slot
+		{
+			std::atomic<T> value;
+		};
+
+		int n;
+		Slot *slots;
+};
+
+
+#endif		// SHARD_H
@@ -0,0 +1,230 @@
+#ifndef _GNU_SOURCE
+	#define _GNU_SOURCE	// sched_setaffinity, CPU_SET
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <omp.h>
+
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+/*	CPU topology and thread placement, so a thread-count sweep measures
+	the code and not where the OS happened to put the threads.
+
+	The topology is the CPUs this process may run on, each with its
+	socket and core from /sys/devices/system/cpu/cpuN/topology; a CPU
+	without that data counts as its own core on socket 0. Placement
+	policies for a team of n threads:
+
+		none		leave the threads where the OS puts them
+		compact		fill every hardware thread of a core, then the next
+					core, then the next socket
+		scatter		round-robin over sockets, then cores, and only then
+					the second hardware thread of each core
+		core		one thread per physical core, socket by socket; past
+					the core count, second hardware threads the same way
+		socket		threads in equal blocks per socket, each free to run
+					on any CPU of its socket
+
+	With more threads than places, threads wrap around and share.
+
+	Place( ) pins each thread of a team of n threads to its CPUs, from
+	inside a parallel region, since libgomp reads OMP_PLACES only at
+	startup. libgomp keeps its pool, so later teams of n threads run
+	where they were put; call it again whenever the team size changes,
+	as new pool threads inherit the master's CPUs. The last placement is
+	kept in Topology::Current( ) and written with every Bench record.
+*/
+
+enum { PLACE_NONE, PLACE_COMPACT, PLACE_SCATTER, PLACE_CORE, PLACE_SOCKET, NUMPLACES };
+
+static const char *PLACENAMES[NUMPLACES] = { "none", "compact", "scatter", "core", "socket" };
+
+/* One CPU the process may run on */
+struct Cpu
+{
+	int id;			// OS CPU number
+	int socket;		// physical package
+	int core;		// core number within the package
+	int smt;		// hardware thread within the core, 0 first
+	int rank;		// core's index within its socket
+};
+
+class Topology
+{
+	public:
+		// The machine this process runs on, read once
+		static const Topology &Machine( )
+		{
+			static Topology machine;
+			return machine;
+		}
+
+		// The last placement applied, e.g. "scatter 0,2,1,3"; "" if none yet
+		static std::string &Current( )
+		{
+			static std::string current;
+			return current;
+		}
+
+		// Machine( ).place( ), with a warning on stderr if a thread could not be pinned
+		static bool Place( int policy, int threads )
+		{
+			bool ok = Machine( ).place( policy, threads );
+			if( !ok ) fprintf( stderr, "Could not pin every thread for placement %s\n", Current( ).c_str( ) );
+			return ok;
+		}
+
+		const std::vector<Cpu> &cpus( ) const { return all; }
+		int sockets( ) const { return nsockets; }
+		int cores( ) const { return ncores; }
+
+		// "S sockets, C cores, N CPUs"
+		void describe( FILE *fp ) const
+		{
+			fprintf( fp, "%d socket%s, %d core%s, %d CPU%s", nsockets, nsockets == 1 ? "" : "s",
+				ncores, ncores == 1 ? "" : "s", (int) all.size( ), all.size( ) == 1 ? "" : "s" );
+		}
+
+		// The CPUs each of threads threads may run on under policy; empty for none
+		std::vector< std::vector<int> > plan( int policy, int threads ) const
+		{
+			std::vector< std::vector<int> > sets;
+			if( policy == PLACE_NONE || all.empty( ) ) return sets;
+			sets.resize( threads );
+
+			std::vector<Cpu> order( all );
+			switch( policy )
+			{
+				case PLACE_COMPACT:
+					std::sort( order.begin( ), order.end( ), []( const Cpu &a, const Cpu &b )
+						{ return Key( a.socket, a.core, a.smt ) < Key( b.socket, b.core, b.smt ); } );
+					break;
+
+				case PLACE_SCATTER:
+					std::sort( order.begin( ), order.end( ), []( const Cpu &a, const Cpu &b )
+						{ return Key( a.smt, a.rank, a.socket ) < Key( b.smt, b.rank, b.socket ); } );
+					break;
+
+				case PLACE_CORE:
+					std::sort( order.begin( ), order.end( ), []( const Cpu &a, const Cpu &b )
+						{ return Key( a.smt, a.socket, a.core ) < Key( b.smt, b.socket, b.core ); } );
+					break;
+
+				case PLACE_SOCKET:
+					for( int t = 0; t < threads; t++ )
+					{
+						int s = (int)( (long) t * nsockets / threads );
+						for( size_t i = 0; i < all.size( ); i++ )
+							if( SocketIndex( all[i].socket ) == s ) sets[t].push_back( all[i].id );
+					}
+					return sets;
+			}
+
+			for( int t = 0; t < threads; t++ )
+				sets[t].push_back( order[ t % order.size( ) ].id );
+			return sets;
+		}
+
+		/*	Pins every thread of a team of threads threads under policy and
+			records the mapping in Current( ). Returns false if any thread
+			could not be pinned; the others stay pinned. */
+		bool place( int policy, int threads ) const
+		{
+			std::vector< std::vector<int> > sets = plan( policy, threads );
+			std::string &current = Current( );
+			current = PLACENAMES[policy];
+			if( sets.empty( ) ) return true;
+
+			int failed = 0;
+			#pragma omp parallel num_threads(threads) reduction(+:failed)
+			{
+				const std::vector<int> &mine = sets[ omp_get_thread_num( ) ];
+				cpu_set_t mask;
+				CPU_ZERO( &mask );
+				for( size_t i = 0; i < mine.size( ); i++ )
+					CPU_SET( mine[i], &mask );
+				if( sched_setaffinity( 0, sizeof(mask), &mask ) != 0 ) failed++;
+			}
+
+			// Threads in order: a CPU each, or s<socket> for the socket policy
+			char buf[32];
+			for( int t = 0; t < threads; t++ )
+			{
+				if( policy == PLACE_SOCKET ) snprintf( buf, sizeof(buf), "%cs%d", t ? ',' : ' ', (int)( (long) t * nsockets / threads ) );
+				else snprintf( buf, sizeof(buf), "%c%d", t ? ',' : ' ', sets[t][0] );
+				current += buf;
+			}
+
+			return failed == 0;
+		}
+
+	private:
+		Topology( ) : nsockets( 0 ), ncores( 0 )
+		{
+			cpu_set_t allowed;
+			CPU_ZERO( &allowed );
+			if( sched_getaffinity( 0, sizeof(allowed), &allowed ) != 0 ) return;
+
+			for( int id = 0; id < CPU_SETSIZE; id++ )
+			{
+				if( !CPU_ISSET( id, &allowed ) ) continue;
+				Cpu c = { id, ReadId( id, "physical_package_id", 0 ), ReadId( id, "core_id", id ), 0, 0 };
+				all.push_back( c );
+			}
+
+			// Hardware thread numbers within each core, and core ranks within each socket
+			std::sort( all.begin( ), all.end( ), []( const Cpu &a, const Cpu &b )
+				{ return Key( a.socket, a.core, a.id ) < Key( b.socket, b.core, b.id ); } );
+			for( size_t i = 0; i < all.size( ); i++ )
+			{
+				bool newSocket = i == 0 || all[i].socket != all[i - 1].socket;
+				bool newCore = newSocket || all[i].core != all[i - 1].core;
+
+				all[i].smt = newCore ? 0 : all[i - 1].smt + 1;
+				all[i].rank = newSocket ? 0 : all[i - 1].rank + ( newCore ? 1 : 0 );
+				if( newSocket ) socketIds.push_back( all[i].socket );
+				if( newCore ) ncores++;
+			}
+			nsockets = (int) socketIds.size( );
+		}
+
+		// A number from the CPU's sysfs topology directory, or fallback
+		static int ReadId( int cpu, const char *file, int fallback )
+		{
+			char path[128];
+			snprintf( path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, file );
+			FILE *fp = fopen( path, "r" );
+			if( fp == NULL ) return fallback;
+
+			int v;
+			if( fscanf( fp, "%d", &v ) != 1 ) v = fallback;
+			fclose( fp );
+			return v;
+		}
+
+		// Sort key for three small non-negative numbers, most significant first
+		static long long Key( int a, int b, int c )
+		{
+			return ( (long long) a << 42 ) | ( (long long) b << 21 ) | c;
+		}
+
+		// Position of a socket id among the sockets present
+		int SocketIndex( int socket ) const
+		{
+			return (int)( std::find( socketIds.begin( ), socketIds.end( ), socket ) - socketIds.begin( ) );
+		}
+
+		std::vector<Cpu> all;			// sorted by socket, core, hardware thread
+		std::vector<int> socketIds;		// in order
+		int nsockets;
+		int ncores;
+};
+
+
+#endif		// TOPOLOGY_H
@@ -0,0 +1,244 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <atomic>
+#include <omp.h>
+
+#ifndef TRACE_H
+#define TRACE_H
+
+/*	Per-thread timeline tracing, exported as Chrome trace JSON, to see
+	what each thread does inside a parallel region: who idles under a
+	static schedule, how long each thread waits at a barrier.
+
+	TRACE_SCOPE( "name" ) records one event from there to the end of the
+	enclosing block, on the calling thread. name must outlive the program
+	run, e.g. a string literal. Each thread appends to its own buffer,
+	with no locks or atomic read-modify-writes after the thread's first
+	event; a full buffer drops further events and counts them.
+
+	Set BENCH_TRACE=file.json to trace; at exit every thread's events are
+	written there for chrome://tracing or ui.perfetto.dev, and the event
+	count and an estimate of the time tracing cost, from timing the
+	recording of events, go to stderr. Without BENCH_TRACE a scope costs a
+	test and a branch; built with -DTRACE=0, nothing at all.
+*/
+
+// 0 compiles every TRACE_SCOPE out
+#ifndef TRACE
+	#define TRACE		1
+#endif
+
+// Events kept per thread
+#ifndef TRACEEVENTS
+	#define TRACEEVENTS	(1 << 16)
+#endif
+
+#define TRACE_CAT2( a, b )	a ## b
+#define TRACE_CAT( a, b )	TRACE_CAT2( a, b )
+
+#if TRACE
+	#define TRACE_SCOPE( name )	TraceScope TRACE_CAT( traceScope, __LINE__ )( name )
+#else
+	#define TRACE_SCOPE( name )
+#endif
+
+/* One finished scope */
+struct TraceEvent
+{
+	const char *name;
+	uint64_t start;		// ns since the trace began
+	uint64_t dur;		// ns
+};
+
+/* One thread's events; only that thread writes it */
+struct TraceBuffer
+{
+	TraceEvent events[TRACEEVENTS];
+	std::atomic<int> count;			// events[0..count-1] are complete
+	long dropped;
+	int tid;						// OS thread id
+	int ompThread;					// omp_get_thread_num( ) at its first event, -1 if not an OpenMP thread
+	TraceBuffer *next;				// the list of every thread's buffer
+};
+
+class Trace
+{
+	public:
+		// True if BENCH_TRACE names a file to trace to
+		static bool On( )
+		{
+			static bool on = Init( );
+			return on;
+		}
+
+		// ns since the trace began
+		static uint64_t Now( )
+		{
+			struct timespec ts;
+			clock_gettime( CLOCK_MONOTONIC, &ts );
+			return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec - Base( );
+		}
+
+		// Appends an event to the calling thread's buffer
+		static void Record( const char *name, uint64_t start, uint64_t end )
+		{
+			TraceBuffer *b = Mine( );
+			if( b == NULL ) b = Register( );
+
+			int n = b->count.load( std::memory_order_relaxed );
+			if( n == TRACEEVENTS )
+			{
+				b->dropped++;
+				return;
+			}
+			b->events[n] = TraceEvent{ name, start, end - start };
+			b->count.store( n + 1, std::memory_order_release );
+		}
+
+		// Writes every buffer to BENCH_TRACE and the overhead estimate to stderr; runs at exit
+		static void Write( )
+		{
+			const char *path = getenv( "BENCH_TRACE" );
+			FILE *fp = fopen( path, "w" );
+			if( fp == NULL )
+			{
+				perror( path );
+				return;
+			}
+
+			long events = 0, dropped = 0;
+			int threads = 0;
+			double cost = PerEvent( );
+
+			fprintf( fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n" );
+			int pid = (int) getpid( );
+			bool first = true;
+			for( TraceBuffer *b = Head( ).load( std::memory_order_acquire ); b != NULL; b = b->next )
+			{
+				fprintf( fp, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s %d\"}}",
+					first ? "" : ",\n", pid, b->tid, b->ompThread >= 0 ? "omp thread" : "thread", b->ompThread >= 0 ? b->ompThread : b->tid );
+				fprintf( fp, ",\n{\"ph\":\"M\",\"name\":\"thread_sort_index\",\"pid\":%d,\"tid\":%d,\"args\":{\"sort_index\":%d}}",
+					pid, b->tid, b->ompThread >= 0 ? b->ompThread : b->tid );
+				first = false;
+
+				int n = b->count.load( std::memory_order_acquire );
+				for( int i = 0; i < n; i++ )
+				{
+					const TraceEvent &e = b->events[i];
+					fprintf( fp, ",\n{\"ph\":\"X\",\"name\":\"%s\",\"pid\":%d,\"tid\":%d,\"ts\":%.3lf,\"dur\":%.3lf}",
+						e.name, pid, b->tid, e.start / 1000., e.dur / 1000. );
+				}
+				events += n;
+				dropped += b->dropped;
+				threads++;
+			}
+			fprintf( fp, "\n],\"otherData\":{\"events\":%ld,\"dropped\":%ld,\"nsPerEvent\":%.1lf}}\n", events, dropped, cost );
+			fclose( fp );
+
+			fprintf( stderr, "Trace: %ld events on %d threads, %ld dropped, about %.3lf ms of tracing (%.0lf ns per event), in %s\n",
+				events, threads, dropped, events * cost / 1e6, cost, path );
+		}
+
+	private:
+		static bool Init( )
+		{
+			const char *path = getenv( "BENCH_TRACE" );
+			if( path == NULL || path[0] == '\0' ) return false;
+
+			Base( );
+			atexit( Write );
+			return true;
+		}
+
+		// The monotonic clock when the trace began, in ns
+		static uint64_t Base( )
+		{
+			static uint64_t base = Clock( );
+			return base;
+		}
+
+		static uint64_t Clock( )
+		{
+			struct timespec ts;
+			clock_gettime( CLOCK_MONOTONIC, &ts );
+			return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+		}
+
+		static TraceBuffer *&Mine( )
+		{
+			static thread_local TraceBuffer *mine = NULL;
+			return mine;
+		}
+
+		static std::atomic<TraceBuffer *> &Head( )
+		{
+			static std::atomic<TraceBuffer *> head( NULL );
+			return head;
+		}
+
+		// Gives the calling thread a buffer and pushes it on the list; once per thread
+		static TraceBuffer *Register( )
+		{
+			TraceBuffer *b = new TraceBuffer;
+			b->count.store( 0, std::memory_order_relaxed );
+			b->dropped = 0;
+			b->tid = (int) syscall( SYS_gettid );
+			b->ompThread = omp_in_parallel( ) || b->tid == (int) getpid( ) ? omp_get_thread_num( ) : -1;
+			b->next = Head( ).load( std::memory_order_relaxed );
+			while( !Head( ).compare_exchange_weak( b->next, b, std::memory_order_release, std::memory_order_relaxed ) )
+				;
+			Mine( ) = b;
+			return b;
+		}
+
+		// ns one scope costs this thread: two clock reads and a Record( ), timed into a scratch buffer
+		static double PerEvent( )
+		{
+			const int REPS = 10000;
+			TraceBuffer *mine = Mine( );
+			TraceBuffer *scratch = new TraceBuffer;
+			scratch->count.store( 0, std::memory_order_relaxed );
+			scratch->dropped = 0;
+			Mine( ) = scratch;
+
+			uint64_t t0 = Now( );
+			for( int i = 0; i < REPS; i++ )
+			{
+				uint64_t start = Now( );
+				Record( "calibrate", start, Now( ) );
+			}
+			double ns = (double)( Now( ) - t0 ) / REPS;
+
+			Mine( ) = mine;
+			delete scratch;
+			return ns;
+		}
+};
+
+/* Records the time from its construction to its destruction, if tracing */
+class TraceScope
+{
+	public:
+		TraceScope( const char *name ) : name( Trace::On( ) ? name : NULL ), start( this->name != NULL ? Trace::Now( ) : 0 )
+		{
+		}
+
+		~TraceScope( )
+		{
+			if( name != NULL ) Trace::Record( name, start, Trace::Now( ) );
+		}
+
+		TraceScope( const TraceScope & ) = delete;
+		TraceScope &operator=( const TraceScope & ) = delete;
+
+	private:
+		const char *name;
+		uint64_t start;
+};
+
+
+#endif		// TRACE_H
@@ -1,8 +1,14 @@
 #include <omp.h>
 #include <stdio.h>
 #include <math.h>
+#include <stdlib.h>
+#include "../Common/bench.h"
+#include "../Common/config.h"
+#include "../Common/topology.h"
 
-// Pass values using -D, but provide defaults:
+/*	Run as: proj00 [threads=N] [size=N] [tries=N] [warmup=N] [place=policy] [config=file]
+	The -D values below are the defaults; place pins the threads
+	(none, compact, scatter, core or socket; Common/topology.h). */
 
 #ifndef NUMT
 	#define NUMT		1
@@ -16,11 +22,11 @@
 	#define NUMTRIES 100000
 #endif
 
-float A[ARRAYSIZE];
-float B[ARRAYSIZE];
-float C[ARRAYSIZE];
+#ifndef WARMUP
+	#define WARMUP 10
+#endif
 
-int main() 
+int main( int argc, char **argv ) 
 {
 
 #ifndef _OPENMP
@@ -28,36 +34,51 @@ int main()
 	return 1;
 #endif
 
-	omp_set_num_threads( NUMT );
-	fprintf( stderr, "Using %d threads\n", NUMT );
+	Config cfg( argc, argv );
+	int numt = cfg.get( "threads", NUMT );
+	int size = cfg.get( "size", ARRAYSIZE );
+	int tries = cfg.get( "tries", NUMTRIES );
+	int warmup = cfg.get( "warmup", WARMUP );
+	int place = cfg.choice( "place", PLACENAMES, NUMPLACES, PLACE_NONE );
+	if( !cfg.check( stderr ) ) return 1;
+
+	float *A = (float *) calloc( size, sizeof(float) );
+	float *B = (float *) calloc( size, sizeof(float) );
+	float *C = (float *) calloc( size, sizeof(float) );
+
+	omp_set_num_threads( numt );
+	Topology::Place( place, numt );
+	fprintf( stderr, "Using %d threads\n", numt );
+
+	Bench bench( "proj00", size, warmup, tries );
+	bench.config( "threads=%d size=%d", numt, size );
+	bench.count( numt );
 
-	double maxMegaMults = 0.;
-	double sumMegaMults = 0.;
 	double start = omp_get_wtime( );
 
-	for( int t = 0; t < NUMTRIES; t++ )
+	while( bench.next( ) )
 	{
-		double time0 = omp_get_wtime( );
-
 		#pragma omp parallel for
-		for( int i = 0; i < ARRAYSIZE; i++ )
+		for( int i = 0; i < size; i++ )
 		{
 			C[i] = A[i] * B[i];
 		}
-
-		double time1 = omp_get_wtime( );
-		double megaMults = (double)ARRAYSIZE/(time1-time0)/1000000.;
-		sumMegaMults += megaMults;
-		if( megaMults > maxMegaMults )
-			maxMegaMults = megaMults;
 	}
 
 	double end = omp_get_wtime( );
-	double avgMegaMults = sumMegaMults/(double)NUMTRIES;
+	const BenchStats &s = bench.stats( );
+	bench.report( );
+
+	printf( "Elapsed time: %8.2lf Sec\n", end - start);
+	printf( "   Peak Performance = %8.2lf MegaMults/Sec\n", bench.mrate( s.min ) );
+	printf( "Average Performance = %8.2lf MegaMults/Sec\n", bench.mrate( s.mean ) );
+	printf( " Median Performance = %8.2lf MegaMults/Sec (%.2lf - %.2lf), %d of %d tries kept\n",
+		bench.mrate( s.median ), bench.mrate( s.ciHigh ), bench.mrate( s.ciLow ), s.kept, s.reps );
+	if( bench.counters( ) != NULL ) bench.counters( )->print( stdout, "proj00" );
 
-    printf( "Elapsed time: %8.2lf Sec\n", end - start);
-	printf( "   Peak Performance = %8.2lf MegaMults/Sec\n", maxMegaMults );
-	printf( "Average Performance = %8.2lf MegaMults/Sec\n", avgMegaMults );
+	free( A );
+	free( B );
+	free( C );
 
 	// note: %lf stands for "long float", which is how printf prints a "double"
 	//	%d stands for "decimal integer", not "double"
@@ -2,6 +2,29 @@
 #include <stdio.h>
 #include <math.h>
 #include <float.h>
+#include "../Common/bench.h"
+#include "../Common/config.h"
+#include "../Common/topology.h"
+#include "../Common/scaling.h"
+#include "../Common/trace.h"
+
+/*	Run as: proj1 [nodes=N] [threads=N] [tries=N] [warmup=N] [place=policy] [tol=T] [config=file]
+	Sweeps 1 to threads threads over a nodes x nodes grid, each team
+	pinned by place (none, compact, scatter, core or socket;
+	Common/topology.h). The -D values below are the defaults.
+
+	Fp is Amdahl's parallel fraction from each thread count alone; the
+	Amdahl, Gustafson and USL fits over the whole sweep (Common/scaling.h)
+	go to stderr, and Common/scalefit fits every node count in the
+	results store.
+
+	With tol, instead compares at threads threads the work each method
+	needs to get the volume within tol of the exact one: the uniform grid
+	at the fewest 2^k + 1 nodes that do, and adaptive quadrature, which
+	splits (u,v) cells in four, as OpenMP tasks, wherever its local error
+	estimate is over the cell's share of a target. The target is the
+	loosest, tol times a power of 4, that still gets within tol, as the
+	node count is for the grid. */
 
 // Default NUMT to serial if not compiled with -D
 #ifndef NUMT
@@ -15,7 +38,37 @@
 
 // Default NUMTRIES to 8 if not compiled with -D
 #ifndef NUMTRIES
-	#define NUMTRIES
+	#define NUMTRIES 8
+#endif
+
+// Untimed runs before the NUMTRIES timed ones
+#ifndef WARMUP
+	#define WARMUP 1
+#endif
+
+// Target volume error for the adaptive comparison; 0 runs the thread sweep
+#ifndef TOLERANCE
+	#define TOLERANCE 0.
+#endif
+
+// Adaptive cells are split at most this many times
+#ifndef MAXDEPTH
+	#define MAXDEPTH 16
+#endif
+
+// Adaptive cells above this depth split into tasks; deeper ones run on in their parent's task
+#ifndef TASKDEPTH
+	#define TASKDEPTH 5
+#endif
+
+// Largest uniform grid the comparison tries
+#ifndef MAXNODES
+	#define MAXNODES 16385
+#endif
+
+// The adaptive error estimate target is looked for within tol / LOCALRANGE .. tol * LOCALRANGE
+#ifndef LOCALRANGE
+	#define LOCALRANGE 1e6
 #endif
 
 // Surface definition
@@ -64,12 +117,9 @@
 #define BOTZ23  -8.
 #define BOTZ33  -3.
 
-// Surface height function
-double Height( int iu, int iv )	// iu,iv = 0 .. NUMNODES-1
+// Surface height function at u,v = 0. .. 1.
+double HeightAt( double u, double v )
 {
-	double u = (double)iu / (double)(NUMNODES-1);
-	double v = (double)iv / (double)(NUMNODES-1);
-
 	// the basis functions:
 
 	double bu0 = (1.-u) * (1.-u) * (1.-u);
@@ -98,8 +148,229 @@ double Height( int iu, int iv )	// iu,iv = 0 .. NUMNODES-1
 						// then that contribution to the overall volume is negative
 }
 
+// Surface height function at a grid node
+double Height( int iu, int iv, int nodes )	// iu,iv = 0 .. nodes-1
+{
+	double u = (double)iu / (double)(nodes-1);
+	double v = (double)iv / (double)(nodes-1);
+	return HeightAt( u, v );
+}
+
+// Exact volume: every cubic Bernstein basis function integrates to 1/4 over 0 .. 1
+double ExactVolume( )
+{
+	double sum =	TOPZ00 + TOPZ10 + TOPZ20 + TOPZ30 + TOPZ01 + TOPZ11 + TOPZ21 + TOPZ31
+				+ TOPZ02 + TOPZ12 + TOPZ22 + TOPZ32 + TOPZ03 + TOPZ13 + TOPZ23 + TOPZ33
+				- ( BOTZ00 + BOTZ10 + BOTZ20 + BOTZ30 + BOTZ01 + BOTZ11 + BOTZ21 + BOTZ31
+				+ BOTZ02 + BOTZ12 + BOTZ22 + BOTZ32 + BOTZ03 + BOTZ13 + BOTZ23 + BOTZ33 );
+
+	return ( XMAX - XMIN ) * ( YMAX - YMIN ) * sum / 16.;
+}
+
+// Volume by the trapezoid rule over a nodes x nodes grid, on the current team
+double Uniform( int nodes )
+{
+	double volume = 0;
+
+	// Each thread's share is traced; the gap before the join is its wait for the reduction
+	#pragma omp parallel default(none) shared(nodes) reduction(+:volume)
+	{
+	TRACE_SCOPE( "heights" );
+	#pragma omp for nowait
+	for( int i = 0; i < nodes*nodes; i++ )
+	{
+		// Get current coordinates
+		int iu = i % nodes;
+		int iv = i / nodes;
+
+		// Check for edge/corner & get area coefficient: edge = 0.5, corner = 0.25
+		double edgeFactor = 1.;
+		if ( iu == 0 || iu == ( nodes -1 ) ) edgeFactor *= 0.5;
+		if ( iv == 0 || iv == ( nodes -1 ) ) edgeFactor *= 0.5;
+
+		// Calculate area if tile is full-sized	
+		double fullTileArea =	(  ( ( XMAX - XMIN )/(double)(nodes-1) )  *
+							( ( YMAX - YMIN )/(double)(nodes-1) )  );
+
+		// Calculate actual volume of column
+		volume += edgeFactor * fullTileArea * Height( iu, iv, nodes );
+
+	}
+	}
+
+	return volume;
+}
+
+
+// Result of adaptive quadrature over a cell
+struct quad
+{
+	double volume;
+	long evals;			// Height evaluations
+	long cells;			// cells accepted
+};
+
+typedef struct quad Quad;
+
+Quad Adapt( double, double, double, const double [2][2], double, int );
+
+// Adapts child q of a cell, q % 2 along u and q / 2 along v, given the cell's 3 x 3 samples
+Quad Child( int q, double u0, double v0, double h, double f[3][3], double tol, int depth )
+{
+	int a = q % 2, b = q / 2;
+	double c[2][2] = { { f[a][b], f[a][b+1] }, { f[a+1][b], f[a+1][b+1] } };
+
+	return Adapt( u0 + a * h / 2., v0 + b * h / 2., h / 2., c, tol / 4., depth + 1 );
+}
+
+/*	Volume over the h x h cell at u0,v0 with corner heights c[u][v], to
+	within tol. The trapezoid rule on the cell and on its four quarters
+	differ by about three times the error of the quarters (it falls as
+	h squared), so if that is within tol the quarters are kept, with that
+	error taken off, and otherwise each quarter is adapted to a quarter
+	of tol. */
+Quad Adapt( double u0, double v0, double h, const double c[2][2], double tol, int depth )
+{
+	double f[3][3];
+	f[0][0] = c[0][0];	f[0][2] = c[0][1];
+	f[2][0] = c[1][0];	f[2][2] = c[1][1];
+	f[1][0] = HeightAt( u0 + h / 2., v0 );
+	f[0][1] = HeightAt( u0, v0 + h / 2. );
+	f[1][1] = HeightAt( u0 + h / 2., v0 + h / 2. );
+	f[2][1] = HeightAt( u0 + h, v0 + h / 2. );
+	f[1][2] = HeightAt( u0 + h / 2., v0 + h );
+
+	double area = h * ( XMAX - XMIN ) * h * ( YMAX - YMIN );
+	double whole = area / 4. * ( f[0][0] + f[0][2] + f[2][0] + f[2][2] );
+	double quarters = area / 16. * ( f[0][0] + f[0][2] + f[2][0] + f[2][2]
+					+ 2. * ( f[1][0] + f[0][1] + f[2][1] + f[1][2] ) + 4. * f[1][1] );
+
+	if( fabs( quarters - whole ) / 3. <= tol || depth >= MAXDEPTH )
+		return Quad{ quarters + ( quarters - whole ) / 3., 5, 1 };
+
+	Quad sub[4];
+	if( depth < TASKDEPTH )
+	{
+		for( int q = 0; q < 4; q++ )
+		{
+			#pragma omp task default(none) shared(sub, f) firstprivate(q, u0, v0, h, tol, depth)
+			sub[q] = Child( q, u0, v0, h, f, tol, depth );
+		}
+		#pragma omp taskwait
+	}
+	else
+	{
+		for( int q = 0; q < 4; q++ )
+			sub[q] = Child( q, u0, v0, h, f, tol, depth );
+	}
+
+	// Summed in a fixed order, so the volume does not depend on the threads
+	Quad sum = { 0., 5, 0 };
+	for( int q = 0; q < 4; q++ )
+	{
+		sum.volume += sub[q].volume;
+		sum.evals += sub[q].evals;
+		sum.cells += sub[q].cells;
+	}
+	return sum;
+}
+
+// Adaptive quadrature over the whole surface, on the current team
+Quad Adaptive( double tol )
+{
+	Quad result;
 
-int main() 
+	#pragma omp parallel default(none) shared(tol, result)
+	#pragma omp single
+	{
+		TRACE_SCOPE( "adapt" );
+		double c[2][2] = { { HeightAt( 0., 0. ), HeightAt( 0., 1. ) }, { HeightAt( 1., 0. ), HeightAt( 1., 1. ) } };
+		result = Adapt( 0., 0., 1., c, tol, 0 );
+		result.evals += 4;
+	}
+
+	return result;
+}
+
+/*	Uniform grid against adaptive quadrature for a volume within tol, at
+	numt threads: one CSV line for each */
+int Compare( double tol, int numt, int place, int warmup, int tries )
+{
+	double exact = ExactVolume( );
+
+	omp_set_num_threads( numt );
+	Topology::Place( place, numt );
+
+	// The fewest 2^k + 1 nodes whose volume is within tol
+	int nodes = 2;
+	while( fabs( Uniform( nodes ) - exact ) > tol && 2 * nodes - 1 <= MAXNODES )
+		nodes = 2 * nodes - 1;
+
+	/*	Likewise the loosest error estimate target, tol times a power of 4,
+		whose adaptive volume is within tol: the estimates are of the
+		unextrapolated quarters, so tol itself overshoots */
+	double local = tol;
+	while( fabs( Adaptive( local ).volume - exact ) > tol && local > tol / LOCALRANGE )
+		local /= 4.;
+	while( fabs( Adaptive( 4. * local ).volume - exact ) <= tol && local < tol * LOCALRANGE )
+		local *= 4.;
+
+	fprintf( stdout, "Method,Tolerance,Threads,Nodes,Estimate Target,Cells,Height Evals,Volume,Error,Avg Time,Peak Time" );
+	Bench::CounterHeader( stdout );
+	fprintf( stdout, "\n" );
+
+	double volume = 0., uniformTime, adaptiveTime;
+	long uniformEvals = (long)nodes * nodes;
+	Quad q;
+
+	{
+		Bench bench( "proj1", (double)uniformEvals, warmup, tries );
+		bench.config( "method=uniform tol=%g threads=%d", tol, numt );
+		bench.count( numt );
+		while( bench.next( ) )
+		{
+			volume = Uniform( nodes );
+			DoNotOptimize( volume );
+		}
+		const BenchStats &stats = bench.stats( );
+		bench.report( );
+		uniformTime = stats.mean;
+
+		fprintf( stdout, "uniform,%g,%d,%d,,%ld,%ld,%.10lf,%.3le,%lf,%lf", tol, numt, nodes, (long)( nodes - 1 ) * ( nodes - 1 ),
+			uniformEvals, volume, fabs( volume - exact ), stats.mean, stats.min );
+		bench.counterColumns( stdout );
+		fprintf( stdout, "\n" );
+		if( fabs( volume - exact ) > tol ) fprintf( stderr, "Uniform grid is not within %g at MAXNODES = %d\n", tol, MAXNODES );
+	}
+
+	{
+		q = Adaptive( local );
+		Bench bench( "proj1", (double)q.evals, warmup, tries );
+		bench.config( "method=adaptive tol=%g threads=%d", tol, numt );
+		bench.count( numt );
+		while( bench.next( ) )
+		{
+			q = Adaptive( local );
+			DoNotOptimize( q.volume );
+		}
+		const BenchStats &stats = bench.stats( );
+		bench.report( );
+		adaptiveTime = stats.mean;
+
+		fprintf( stdout, "adaptive,%g,%d,,%g,%ld,%ld,%.10lf,%.3le,%lf,%lf", tol, numt, local, q.cells,
+			q.evals, q.volume, fabs( q.volume - exact ), stats.mean, stats.min );
+		bench.counterColumns( stdout );
+		fprintf( stdout, "\n" );
+	}
+
+	fprintf( stderr, "Exact volume %.10lf; adaptive used %.1lfx fewer Height evaluations and %.2lfx the time of the uniform grid\n",
+		exact, (double)uniformEvals / q.evals, adaptiveTime / uniformTime );
+
+	return 0;
+}
+
+
+int main( int argc, char **argv ) 
 {
 
 #ifndef _OPENMP
@@ -110,12 +381,8 @@ int main()
 	double	volume,			// Volume result
 			mhpsAvg,			// Megaheights per second
 			mhpsPeak,			// Megaheights per second
-			tStart,			// Wall time start
-			tEnd,			// Wall time end
-			tLast,			// Duration of most recent calculation
 			tLastAvg,
 			tLastPeak,
-			tSerial,		// Duration of single threaded loop
 			tSerialAvg,
 			tSerialPeak,
 			speedupAvg,		
@@ -125,67 +392,54 @@ int main()
 			fParallelAvg,
 			fParallelPeak;
 		
+	Config cfg( argc, argv );
+	int nodes = cfg.get( "nodes", NUMNODES );
+	int numt = cfg.get( "threads", NUMT );
+	int tries = cfg.get( "tries", NUMTRIES );
+	int warmup = cfg.get( "warmup", WARMUP );
+	int place = cfg.choice( "place", PLACENAMES, NUMPLACES, PLACE_NONE );
+	double tol = cfg.get( "tol", TOLERANCE );
+	if( !cfg.check( stderr ) ) return 1;
+
+	if( tol > 0. ) return Compare( tol, numt, place, warmup, tries );
+
 	// Print csv headers	
 	fprintf( stdout, "Nodes,Threads,Volume,Avg Time,Avg Mh/s,Avg Speedup,Avg Efficiency,Avg Fp,");
-	fprintf( stdout, "Peak Time,Peak Mh/s,Peak Speedup,Peak Efficiency Avg,Peak Fp\n");
+	fprintf( stdout, "Peak Time,Peak Mh/s,Peak Speedup,Peak Efficiency Avg,Peak Fp");
+	Bench::CounterHeader( stdout );
+	fprintf( stdout, "\n" );
 
-	// Test NUMNODES against threadcounts from 1 to NUMT
-	for( int curT = 1; curT <= NUMT; curT++ )
+	// Speedups over one thread, fitted after the sweep
+	Scaling scalingAvg, scalingPeak;
+
+	// Test nodes against threadcounts from 1 to numt
+	for( int curT = 1; curT <= numt; curT++ )
 	{
 
 		omp_set_num_threads( curT );
+		Topology::Place( place, curT );
 
-		tLastAvg = 0;
-		tLastPeak = DBL_MAX; 
-
-		for ( int i = 0; i < NUMTRIES; i++)
-
-		{
-
-		volume = 0;
-
-		tStart = omp_get_wtime( );
+		Bench bench( "proj1", (double)nodes * nodes, warmup, tries );
+		bench.config( "nodes=%d threads=%d", nodes, curT );
+		bench.count( curT );
 
-		#pragma omp parallel for default(none),reduction(+:volume)
-		for( int i = 0; i < NUMNODES*NUMNODES; i++ )
+		while( bench.next( ) )
 		{
-			// Get current coordinates
-			int iu = i % NUMNODES;
-			int iv = i / NUMNODES;
-		
-			// Check for edge/corner & get area coefficient: edge = 0.5, corner = 0.25
-			double edgeFactor = 1.;
-			if ( iu == 0 || iu == ( NUMNODES -1 ) ) edgeFactor *= 0.5;
-			if ( iv == 0 || iv == ( NUMNODES -1 ) ) edgeFactor *= 0.5;
-	
-			// Calculate area if tile is full-sized	
-			double fullTileArea =	(  ( ( XMAX - XMIN )/(double)(NUMNODES-1) )  *
-								( ( YMAX - YMIN )/(double)(NUMNODES-1) )  );
-
-			// Calculate actual volume of column
-			volume += edgeFactor * fullTileArea * Height( iu, iv );
+			volume = Uniform( nodes );
 
+			DoNotOptimize( volume );
 		}
 
-		tEnd = omp_get_wtime( );
-
-		// Calculate duration
-		tLast = tEnd - tStart;
-
-		// Accumulate for avg
-		tLastAvg += tLast;
+		const BenchStats &stats = bench.stats( );
+		bench.report( );
 
-		// Record peaks
-		if ( tLast < tLastPeak ) tLastPeak = tLast;
-
-		}
-
-		// Calculate average
-		tLastAvg /= (double) NUMTRIES;
+		// Average of the runs kept after outlier rejection, and the fastest
+		tLastAvg = stats.mean;
+		tLastPeak = stats.min;
 
 		// Calculate Megaheights per second
-		mhpsAvg = pow(NUMNODES, 2.) / (tLastAvg) / 1000000.;
-		mhpsPeak = pow(NUMNODES, 2.) / (tLastPeak) / 1000000.;
+		mhpsAvg = pow(nodes, 2.) / (tLastAvg) / 1000000.;
+		mhpsPeak = pow(nodes, 2.) / (tLastPeak) / 1000000.;
 
 		// Record serial performance
 		if ( curT == 1 ) 
@@ -204,19 +458,31 @@ int main()
 		{
 			speedupAvg = tSerialAvg / tLastAvg;
 			efficiencyAvg = speedupAvg / curT;
-			fParallelAvg = (curT / (curT - 1)) * ((tSerialAvg - tLastAvg) / tSerialAvg );
+			fParallelAvg = ( (double) curT / ( curT - 1 ) ) * ((tSerialAvg - tLastAvg) / tSerialAvg );
+			scalingAvg.add( curT, speedupAvg );
 
 			speedupPeak = tSerialPeak / tLastPeak;
 			efficiencyPeak = speedupPeak / curT;
-			fParallelPeak = (curT / (curT - 1)) * ((tSerialPeak - tLastPeak) / tSerialPeak );
+			fParallelPeak = ( (double) curT / ( curT - 1 ) ) * ((tSerialPeak - tLastPeak) / tSerialPeak );
+			scalingPeak.add( curT, speedupPeak );
 		}
 
-		fprintf( stdout, "%d,%d,%lf,", NUMNODES, curT, volume );
+		fprintf( stdout, "%d,%d,%lf,", nodes, curT, volume );
 		fprintf( stdout, "%lf,%lf,%lf,%lf,%lf,", tLastAvg, mhpsAvg, speedupAvg, efficiencyAvg, fParallelAvg );
-		fprintf( stdout, "%lf,%lf,%lf,%lf,%lf\n", tLastPeak, mhpsPeak, speedupPeak, efficiencyPeak, fParallelPeak );
+		fprintf( stdout, "%lf,%lf,%lf,%lf,%lf", tLastPeak, mhpsPeak, speedupPeak, efficiencyPeak, fParallelPeak );
+		bench.counterColumns( stdout );
+		fprintf( stdout, "\n" );
 
 	}
 
+	if( numt > 1 )
+	{
+		scalingAvg.fit( );
+		scalingAvg.print( stderr, "proj1 average" );
+		scalingPeak.fit( );
+		scalingPeak.print( stderr, "proj1 peak" );
+	}
+
 	return 0;	
 
 }
@@ -1,18 +1,63 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
 #include <math.h>
 #include <float.h>
 #include <omp.h>
+#include <sys/wait.h>
+#include "traj.h"
+#include "transport.h"
+#include "../Common/philox.h"
+#include "../Common/bench.h"
+#include "../Common/config.h"
+#include "../Common/topology.h"
+#include "../Common/trace.h"
 
-/*	Compile using -D to set NUMTHREADS, GRAIN in [0:1], OMP_SCHED in [1:4]
-	Default 1 thread, coarse-grained parallelism (0), static scheduling (1)
-	May also set NUMBODIES and NUMSTEPS, but not required for this exercise.
+/*	NUMTHREADS, GRAIN in [0:3], OMP_SCHED in [1:4], NUMBODIES, NUMSTEPS and
+	ITERATIONS set with -D are only defaults now; see the key=value
+	parameters below. Default 1 thread, coarse-grained parallelism (0),
+	static scheduling (1).
+	ITERATIONS timed runs follow WARMUP untimed ones (Common/bench.h).
+
+	Run as: proj2 [-n numBodies] [-s seed] [-i initFile] [-e systems [-l] | -r procs] [-t|-T] [-v] [key=value ...]
+	-n overrides NUMBODIES at runtime, -s picks the random initial conditions,
+	-i starts from the last frame of a trajectory file written with snapevery,
+	-e runs an ensemble of independent systems instead of one big one
+	(one thread per system, or LANES systems per SIMD pack with -l),
+	-r splits the bodies over procs processes that pass their positions
+	around a ring (transport.h), computing on one block while the next
+	one travels; with -v rank 0 checks the result against a one-process run,
+	failing past RINGTOL, and -e -l checks every system against the thread engine,
+	-t auto-tunes threads, grain, schedule and chunk before the timed run
+	(reusing a TUNECACHE entry for this machine and N if there is one),
+	-T retunes even when a cached choice exists,
+	-v reports setup time on stderr.
+
+	Parameters (Common/config.h): threads, grain (coarse, fine, persistent,
+	steal or 0-3), sched (static, dynamic, guided, auto or 1-4), chunk (0
+	for the schedule's default), steps, iterations, warmup, snapevery (a
+	frame to trajfile every snapevery steps, 0 for none), trajfile, ensemblefile,
+	place (none, compact, scatter, core or socket; Common/topology.h),
+	transport (shm or socket, for -r) and config=file. place pins the
+	timed run's team; tuner trials and -r processes are not pinned. With
+	-r, threads is per process.
+	With -t/-T, threads is the most the tuner tries. Every grain and
+	schedule pair is compiled as its own kernel, so one build runs them all.
+	BENCH_TRACE=file.json records each thread's force, update and barrier
+	spans (Common/trace.h), tuner trials included.
 */
 
 #ifndef ITERATIONS
 	#define ITERATIONS 1
 #endif
 
+// Untimed runs before the ITERATIONS timed ones; none when writing a trajectory
+#ifndef WARMUP
+	#define WARMUP 1
+#endif
+
 #ifndef NUMBODIES
 	#define NUMBODIES 100
 #endif
@@ -36,33 +81,78 @@
 	#define OMP_SCHED 1
 #endif
 
-// Now set SCHEDULE, default is static
-
-#if (OMP_SCHED == 1)
-	#define SCHEDULE static
-#elif (OMP_SCHED == 2)
-	#define SCHEDULE dynamic
-#elif (OMP_SCHED == 3)
-	#define SCHEDULE guided
-#elif (OMP_SCHED == 4)
-	#define SCHEDULE auto
-#else
-	#define SCHEDULE static
+#if OMP_SCHED < 1 || OMP_SCHED > 4
+	#undef OMP_SCHED
+	#define OMP_SCHED 1
 #endif
 
 /*	GRAIN reflects the granularity of parallelism:
 	0: coarse-grained		(default)
 	1: fine-grained
+	2: persistent team, one parallel region around the whole time loop
+	3: persistent team with work stealing for the force loop
 */
 
 #ifndef GRAIN
 	#define GRAIN 0
 #endif
 
-#if GRAIN != 0
-	#if GRAIN != 1
-		#define GRAIN 0
-	#endif
+#if GRAIN < 0 || GRAIN > 3
+	#undef GRAIN
+	#define GRAIN 0
+#endif
+
+// Steps between trajectory frames, 0 for no trajectory output
+#ifndef SNAPEVERY
+	#define SNAPEVERY 0
+#endif
+
+#ifndef TRAJFILE
+	#define TRAJFILE "proj2.traj"
+#endif
+
+// Systems packed side by side in SIMD lanes by the ensemble lane engine
+#ifndef LANES
+	#define LANES 8
+#endif
+
+// Largest relative position difference -v allows between the lane and thread engines
+#ifndef LANESTOL
+	#define LANESTOL 1e-4
+#endif
+
+// Largest relative position or velocity difference -v allows between a ring run and a one-process run
+#ifndef RINGTOL
+	#define RINGTOL 1e-4
+#endif
+
+// Per-system results of an ensemble run
+#ifndef ENSEMBLEFILE
+	#define ENSEMBLEFILE "ensemble.csv"
+#endif
+
+// Bodies claimed per grab by the work-stealing scheduler (GRAIN 3)
+#ifndef STEALCHUNK
+	#define STEALCHUNK 1
+#endif
+
+// Steps per auto-tuner measurement, and measurements kept (best of) per candidate
+#ifndef TUNESTEPS
+	#define TUNESTEPS 5
+#endif
+
+#ifndef TUNEREPS
+	#define TUNEREPS 3
+#endif
+
+// Ring transport for -r: 0 shared memory, 1 Unix sockets (transport.h)
+#ifndef TRANSPORT
+	#define TRANSPORT TRANSPORT_SHM
+#endif
+
+// Auto-tuner choices, one line per machine and body count
+#ifndef TUNECACHE
+	#define TUNECACHE "proj2.tune"
 #endif
 
 #ifndef HEADER
@@ -87,13 +177,114 @@ struct body
 
 typedef struct body Body;
 
-Body Bodies[NUMBODIES];
+Body *Bodies;		// heap allocated, NumBodies long
+int NumBodies = NUMBODIES;
+
+/*	One contiguous range of bodies per thread for the work-stealing scheduler.
+	The owner and any thieves all claim from next with an atomic add, so a
+	range is padded to its own cache line to keep the counters from false sharing.
+*/
+struct range
+{
+	int next;
+	int end;
+	char pad[ 64 - 2*sizeof(int) ];
+} __attribute__((aligned(64)));
+
+typedef struct range Range;
+
+Range *Ranges;		// one per thread, NumThreads long
+
+int NumThreads = NUMTHREADS;	// thread count, or the tuner's ceiling
+int NumSteps = NUMSTEPS;		// steps per timed run
+
+TrajWriter *Traj = NULL;	// trajectory output, NULL when disabled
+int SnapEvery = SNAPEVERY;	// steps between frames of Traj
+int64_t StepCount = 0;		// steps completed across all iterations
+
+/*	LANES independent systems stored SoA with the lane index fastest:
+	field[ body*LANES + lane ]. One pass over the bodies then advances
+	every system in the pack with the same vector instructions. */
+struct pack
+{
+	float *mass;
+	float *x, *y, *z, *vx, *vy, *vz;
+	float *xnew, *ynew, *znew, *vxnew, *vynew, *vznew;
+};
+
+typedef struct pack Pack;
+
+/*	A ring message: the positions and masses of one process's bodies,
+	count Sources after the header. Every message is sized for the
+	largest block, so all shifts move the same bytes. */
+struct ringblock
+{
+	int owner;			// rank the bodies belong to
+	int count;
+	int pad[2];
+};
+
+typedef struct ringblock RingBlock;
+
+// One body as the others see it
+struct source
+{
+	float x, y, z, mass;
+};
+
+typedef struct source Source;
+
+/*	A parallel configuration chosen at runtime, by parameters or by the
+	auto-tuner. grain uses the GRAIN numbering (0 coarse, 1 fine,
+	2 persistent, 3 steal) and kind the OMP_SCHED numbering, which matches
+	omp_sched_t. */
+struct tuning
+{
+	int threads;
+	int grain;
+	int kind;
+	int chunk;			// 0 for the schedule's default
+	double stepTime;	// measured seconds per step
+};
+
+typedef struct tuning Tuning;
+
+const char *SCHEDNAMES[] = { "", "static", "dynamic", "guided", "auto" };
+const char *GRAINNAMES[] = { "coarse", "fine", "persistent", "steal" };
+
+// One step kernel: runs steps steps on threads threads with a chunk; returns per-thread barrier wait
+typedef double (*StepsFn)( int, int, int, bool );
 
 // function prototypes:
+void StepBody( Body *, int, int );
+void AddForce( Body *, Body *, float *, float *, float * );
+void Advance( Body *, float, float, float );
+void CopyNew( Body * );
+template <int KIND, typename F> void ForEach( int, int, F );
+template <int KIND> void StepBodyFine( int, int, int );
+template <int G, int KIND> double Steps( int, int, int, bool );
+int RunEnsemble( int, bool, unsigned int, int, int, const char *, bool );
+int RunRing( int, int, unsigned int, int, int, bool );
+void RingStep( Transport *, Body *, int, char **, size_t );
+void RingGather( Transport *, Body *, int, char **, size_t, Source *, bool );
+void StepSystem( Body *, int );
+void StepPack( Pack *, int );
+void Summarize( FILE *, int, unsigned int, const float *, const float *, int );
+void StepDone( );
+void Snapshot( );
+void StealBodies( int, int, int );
+void Tune( Tuning *, bool );
+double TimeConfig( Tuning * );
+double RunSteps( const Tuning *, int, bool );
+void TuningKey( char *, size_t );
+bool LoadTuning( const char *, Tuning *, double * );
+void SaveTuning( const char *, const Tuning *, double );
+double Barrier( );
+double ForkJoinCost( const Tuning *, int );
 float GetDistanceSquared( Body *, Body * );
 float GetUnitVector( Body *, Body *, float *, float *, float * );
-float Ranf( float, float );
-int Ranf( int, int );
+int LoadBodies( const char * );
+void RandomBodies( Body *, int, unsigned int );
 
 int main( int argc, char *argv[ ] )
 {
@@ -102,128 +293,1126 @@ int main( int argc, char *argv[ ] )
 		return 1;
 	#endif
  
-	omp_set_num_threads( NUMTHREADS );
+	unsigned int seed = 1;
+	const char *initFile = NULL;
+	int systems = 0;
+	bool lanes = false;
+	int procs = 0;
+	int tune = 0;		// 1 tune or use the cache, 2 always retune
+	bool verbose = false;
+	int opt;
+
+	// Parameters are the key=value words left after the options, which getopt moves to the end
+	while( ( opt = getopt( argc, argv, "n:s:i:e:lr:tTv" ) ) != -1 )
+	{
+		switch( opt )
+		{
+			case 'n': NumBodies = atoi( optarg ); break;
+			case 's': seed = strtoul( optarg, NULL, 0 ); break;
+			case 'i': initFile = optarg; break;
+			case 'e': systems = atoi( optarg ); break;
+			case 'l': lanes = true; break;
+			case 'r': procs = atoi( optarg ); break;
+			case 't': tune = 1; break;
+			case 'T': tune = 2; break;
+			case 'v': verbose = true; break;
+			default:
+				fprintf( stderr, "Invalid syntax. Try %s [-n numBodies] [-s seed] [-i initFile] [-e systems [-l] | -r procs] [-t|-T] [-v] [key=value ...]\n", argv[0] );
+				return 1;
+		}
+	}
+
+	Config cfg( argc, argv, optind );
+	NumThreads = cfg.get( "threads", NUMTHREADS );
+	NumSteps = cfg.get( "steps", NUMSTEPS );
+	int iterations = cfg.get( "iterations", ITERATIONS );
+	int warmup = cfg.get( "warmup", WARMUP );
+	SnapEvery = cfg.get( "snapevery", SNAPEVERY );
+	const char *trajFile = cfg.get( "trajfile", TRAJFILE );
+	const char *ensembleFile = cfg.get( "ensemblefile", ENSEMBLEFILE );
+	int place = cfg.choice( "place", PLACENAMES, NUMPLACES, PLACE_NONE );
+	int transport = cfg.choice( "transport", TRANSPORTNAMES, NUMTRANSPORTS, TRANSPORT );
+
+	Tuning run;
+	run.threads = NumThreads;
+	run.grain = cfg.choice( "grain", GRAINNAMES, 4, GRAIN );
+	run.kind = cfg.choice( "sched", SCHEDNAMES, 5, OMP_SCHED );
+	run.chunk = cfg.get( "chunk", run.grain == 3 ? STEALCHUNK : 0 );
+	bool showChunk = cfg.has( "chunk" );
+	if( !cfg.check( stderr ) ) return 1;
+
+	if( NumThreads < 1 || ( run.grain == 3 && run.chunk < 1 ) )
+	{
+		fprintf( stderr, "Need threads >= 1, and chunk >= 1 for grain steal\n" );
+		return 1;
+	}
+
+	omp_set_num_threads( NumThreads );
 
-	for( int i = 0; i < NUMBODIES; i++ )
+	// Before anything else runs an OpenMP region: the processes fork from here
+	if( procs > 0 ) return RunRing( procs, transport, seed, iterations, warmup, verbose );
+
+	Ranges = (Range *) aligned_alloc( 64, NumThreads * sizeof(Range) );
+
+	if( systems > 0 )
 	{
-		Bodies[i].mass = EARTH_MASS  * Ranf( 0.5f, 10.f );
-		Bodies[i].x = EARTH_DIAMETER * Ranf( -100.f, 100.f );
-		Bodies[i].y = EARTH_DIAMETER * Ranf( -100.f, 100.f );
-		Bodies[i].z = EARTH_DIAMETER * Ranf( -100.f, 100.f );
-		Bodies[i].vx = Ranf( -100.f, 100.f );;
-		Bodies[i].vy = Ranf( -100.f, 100.f );;
-		Bodies[i].vz = Ranf( -100.f, 100.f );;
-	};
+		Topology::Place( place, NumThreads );
+		return RunEnsemble( systems, lanes, seed, iterations, warmup, ensembleFile, verbose );
+	}
 
-	double tAvg = 0;		// Holds average time for all iterations
-	double tMin = DBL_MAX;	// Holds peak minimum time across all iterations
+	double tSetup = omp_get_wtime( );
 
-	for (int i = 0; i < ITERATIONS; i++)
+	if( initFile != NULL )
 	{
+		if( LoadBodies( initFile ) != 0 )
+		{
+			fprintf( stderr, "Cannot load initial conditions from %s\n", initFile );
+			return 1;
+		}
+	}
+	else
+	{
+		if( NumBodies < 1 )
+		{
+			fprintf( stderr, "Need at least one body\n" );
+			return 1;
+		}
+		Bodies = (Body *) malloc( NumBodies * sizeof(Body) );
+		RandomBodies( Bodies, NumBodies, seed );
+	}
+
+	tSetup = omp_get_wtime( ) - tSetup;
+	if( verbose ) fprintf( stderr, "Setup: %d bodies in %.3lf ms\n", NumBodies, tSetup * 1000. );
 
-		double time0 = omp_get_wtime( );
+	if( SnapEvery > 0 )
+	{
+		float *mass = (float *) malloc( NumBodies * sizeof(float) );
+		for( int i = 0; i < NumBodies; i++ )
+			mass[i] = Bodies[i].mass;
 
-		for( int t = 0; t < NUMSTEPS; t++ )
+		Traj = TrajCreate( trajFile, NumBodies, SnapEvery, TIMESTEP, mass );
+		free( mass );
+		if( Traj == NULL )
 		{
-			#if GRAIN == 0
-				#pragma omp parallel for default(none) shared(Bodies) schedule(SCHEDULE)
-			#endif
-			for( int i = 0; i < NUMBODIES; i++ )
+			fprintf( stderr, "Cannot open trajectory file %s\n", trajFile );
+			return 1;
+		}
+		Snapshot( );	// frame 0 is the initial state
+	}
+
+	// Pick the configuration before timing anything; the state is restored afterwards.
+	Tuning tuned;
+	if( tune ) Tune( &tuned, tune == 2 );
+
+	if( tune )
+	{
+		run = tuned;
+		showChunk = true;
+	}
+
+	Topology::Place( place, run.threads );
+
+	// A warm-up would add its steps to the trajectory
+	Bench bench( "proj2", (double)NumBodies * NumBodies * NumSteps, Traj != NULL ? 0 : warmup, iterations );
+	bench.count( run.threads );
+	double tSync = 0;		// Holds total per-thread time spent waiting at barriers
+
+	while( bench.next( ) )
+	{
+		tSync += RunSteps( &run, NumSteps, true );
+	}
+
+	if( Traj != NULL )
+	{
+		long frames = Traj->frames;
+		long stalls = Traj->stalls;
+		double stallTime = Traj->stallTime;
+		TrajClose( Traj );
+		fprintf( stderr, "Trajectory: %ld frames, %.2lf MB, %ld stalls (%.3lf ms)\n", frames,
+			(double)frames * TrajFrameBytes( NumBodies ) / 1000000., stalls, stallTime * 1000. );
+	}
+
+	// Per-step synchronization overhead in microseconds
+	double usSync;
+	if( run.grain < 2 )
+		// Regions have implicit joins, so estimate from the cost of empty ones.
+		usSync = ForkJoinCost( &run, run.grain == 0 ? 1 : NumBodies ) * 1000000.;
+	else
+		usSync = tSync / bench.runs( ) / NumSteps * 1000000.;
+
+	const BenchStats &stats = bench.stats( );
+	bench.config( "bodies=%d threads=%d grain=%s sched=%s:%d%s", NumBodies, run.threads,
+		GRAINNAMES[run.grain], SCHEDNAMES[run.kind], run.chunk, tune ? " tuned" : "" );
+	bench.report( );
+
+	float MbpsAvg = bench.mrate( stats.mean );
+	float MbpsPeak = bench.mrate( stats.min );
+
+	// Print results as csv. The schedule column carries a tuned or given chunk as kind:chunk
+	fprintf( stdout, "%d,%lf,%lf,%s", run.threads, MbpsAvg, MbpsPeak, SCHEDNAMES[run.kind] );
+	if( showChunk && run.chunk > 0 ) fprintf( stdout, ":%d", run.chunk );
+	fprintf( stdout, ",%s,%lf", GRAINNAMES[run.grain], usSync );
+	bench.counterColumns( stdout );
+	fprintf( stdout, "\n" );
+
+	free( Bodies );
+	free( Ranges );
+
+	return 0;
+
+}
+
+
+// Computes the force on body i of n and its new position and velocity
+void StepBody( Body *bodies, int n, int i )
+{
+	float fx = 0.;
+	float fy = 0.;
+	float fz = 0.;
+	Body *bi = &bodies[i];
+
+	for( int j = 0; j < n; j++ )
+	{
+		if( j == i ) continue;
+
+		AddForce( bi, &bodies[j], &fx, &fy, &fz );
+	}
+
+	Advance( bi, fx, fy, fz );
+}
+
+// Adds the pull of bj on bi to the force sums
+void AddForce( Body *bi, Body *bj, float *fx, float *fy, float *fz )
+{
+	float rsqd = GetDistanceSquared( bi, bj );
+
+	if( rsqd > 0. )
+	{
+		float f = G * bi->mass * bj->mass / rsqd;
+		float ux, uy, uz;
+		GetUnitVector( bi, bj, &ux, &uy, &uz );
+		*fx += f * ux;
+		*fy += f * uy;
+		*fz += f * uz;
+	}
+}
+
+// Sets bi's new position and velocity from the total force on it
+void Advance( Body *bi, float fx, float fy, float fz )
+{
+	float ax = fx / bi->mass;
+	float ay = fy / bi->mass;
+	float az = fz / bi->mass;
+
+	bi->xnew = bi->x + bi->vx*TIMESTEP + 0.5*ax*TIMESTEP*TIMESTEP;
+	bi->ynew = bi->y + bi->vy*TIMESTEP + 0.5*ay*TIMESTEP*TIMESTEP;
+	bi->znew = bi->z + bi->vz*TIMESTEP + 0.5*az*TIMESTEP*TIMESTEP;
+
+	bi->vxnew = bi->vx + ax*TIMESTEP;
+	bi->vynew = bi->vy + ay*TIMESTEP;
+	bi->vznew = bi->vz + az*TIMESTEP;
+}
+
+// setup the state for the next animation step
+void CopyNew( Body *b )
+{
+	b->x = b->xnew;
+	b->y = b->ynew;
+	b->z = b->znew;
+	b->vx = b->vxnew;
+	b->vy = b->vynew;
+	b->vz = b->vznew;
+}
+
+// Counts a finished step and snapshots the state every SnapEvery steps
+void StepDone( )
+{
+	StepCount++;
+
+	if( Traj != NULL && StepCount % SnapEvery == 0 ) Snapshot( );
+}
+
+// Copies the current state into the trajectory writer's free buffer
+void Snapshot( )
+{
+	float *s = TrajBegin( Traj, StepCount );
+
+	for( int i = 0; i < NumBodies; i++ )
+	{
+		s[0*NumBodies + i] = Bodies[i].x;
+		s[1*NumBodies + i] = Bodies[i].y;
+		s[2*NumBodies + i] = Bodies[i].z;
+		s[3*NumBodies + i] = Bodies[i].vx;
+		s[4*NumBodies + i] = Bodies[i].vy;
+		s[5*NumBodies + i] = Bodies[i].vz;
+	}
+
+	TrajCommit( Traj );
+}
+
+/*	Work-stealing force loop: drain our own range first, then walk the
+	other threads' ranges and claim chunk bodies at a time of whatever
+	they have not reached yet. Returns once every range is empty. */
+void StealBodies( int me, int nt, int chunk )
+{
+	TRACE_SCOPE( "forces" );
+	for( int k = 0; k < nt; k++ )
+	{
+		Range *r = &Ranges[ (me + k) % nt ];
+
+		while( __atomic_load_n( &r->next, __ATOMIC_RELAXED ) < r->end )
+		{
+			int first = __atomic_fetch_add( &r->next, chunk, __ATOMIC_RELAXED );
+			int last = first + chunk < r->end ? first + chunk : r->end;
+
+			for( int i = first; i < last; i++ )
+			{
+				StepBody( Bodies, NumBodies, i );
+			}
+		}
+	}
+}
+
+/*	Auto-tuner: times TUNESTEPS-step warm-ups of every candidate thread
+	count, grain, schedule and chunk on a scratch copy of the state and
+	keeps the fastest. Fine grain is left out; it never wins. The choice
+	is cached in TUNECACHE under this machine and body count. */
+void Tune( Tuning *best, bool force )
+{
+	char key[256];
+	TuningKey( key, sizeof(key) );
+
+	double baseTime;
+	if( !force && LoadTuning( key, best, &baseTime ) )
+	{
+		fprintf( stderr, "Tuned (cached): %d threads, %s, %s chunk %d: x%.2lf over coarse static\n",
+			best->threads, GRAINNAMES[best->grain], SCHEDNAMES[best->kind], best->chunk,
+			baseTime / best->stepTime );
+		return;
+	}
+
+	Body *save = (Body *) malloc( NumBodies * sizeof(Body) );
+	memcpy( save, Bodies, NumBodies * sizeof(Body) );
+
+	// The static default everything is compared against
+	Tuning base = { NumThreads, 0, 1, 0, 0. };
+	baseTime = TimeConfig( &base );
+	*best = base;
+
+	const int grains[] = { 0, 2, 3 };
+	const int chunks[] = { 0, 1, 4, 16 };
+	int tried = 0;
+
+	// Powers of two up to NumThreads, and NumThreads itself
+	int counts[32], ncounts = 0;
+	for( int t = 1; t < NumThreads; t *= 2 )
+		counts[ncounts++] = t;
+	counts[ncounts++] = NumThreads;
+
+	for( int n = 0; n < ncounts; n++ )
+	{
+		int threads = counts[n];
+
+		for( int g = 0; g < 3; g++ )
+		{
+			// Stealing has no schedule kind, only a chunk
+			int nkinds = grains[g] == 3 ? 1 : 3;
+
+			for( int k = 1; k <= nkinds; k++ )
 			{
-				float fx = 0.;
-				float fy = 0.;
-				float fz = 0.;
-				Body *bi = &Bodies[i];
-		
-				#if GRAIN == 1
-					#pragma omp parallel for default(none) shared(Bodies, i, bi) reduction(+:fx,fy,fz) schedule(SCHEDULE)
-				#endif			
-				for( int j = 0; j < NUMBODIES; j++ )
+				for( int c = 0; c < 4; c++ )
 				{
-					if( j == i ) continue;
+					if( grains[g] == 3 && chunks[c] == 0 ) continue;
+
+					Tuning t = { threads, grains[g], k, chunks[c], 0. };
+					TimeConfig( &t );
+					tried++;
+
+					if( t.stepTime < best->stepTime ) *best = t;
+				}
+			}
+		}
+	}
+
+	memcpy( Bodies, save, NumBodies * sizeof(Body) );
+	free( save );
+
+	fprintf( stderr, "Tuned (%d candidates): %d threads, %s, %s chunk %d: x%.2lf over coarse static\n",
+		tried, best->threads, GRAINNAMES[best->grain], SCHEDNAMES[best->kind], best->chunk,
+		baseTime / best->stepTime );
+
+	SaveTuning( key, best, baseTime );
+}
+
+// Sets and returns t->stepTime, the best per-step time of TUNEREPS runs after a warm-up
+double TimeConfig( Tuning *t )
+{
+	RunSteps( t, TUNESTEPS, false );
+
+	t->stepTime = DBL_MAX;
+	for( int r = 0; r < TUNEREPS; r++ )
+	{
+		double t0 = omp_get_wtime( );
+		RunSteps( t, TUNESTEPS, false );
+		double dt = ( omp_get_wtime( ) - t0 ) / TUNESTEPS;
+
+		if( dt < t->stepTime ) t->stepTime = dt;
+	}
+
+	return t->stepTime;
+}
+
+/*	Worksharing loop over bodies [0, n) under schedule kind KIND, with
+	chunk or the kind's default chunk if chunk is 0, and no barrier at the
+	end. Call from inside a parallel region. KIND is a template argument,
+	so every kernel gets one fixed schedule clause where schedule(runtime)
+	would look the schedule up on every loop. */
+template <int KIND, typename F>
+inline void ForEach( int n, int chunk, F body )
+{
+	TRACE_SCOPE( "forces" );
+	if( KIND == 2 && chunk > 0 )
+	{
+		#pragma omp for schedule(dynamic, chunk) nowait
+		for( int i = 0; i < n; i++ ) body( i );
+	}
+	else if( KIND == 2 )
+	{
+		#pragma omp for schedule(dynamic) nowait
+		for( int i = 0; i < n; i++ ) body( i );
+	}
+	else if( KIND == 3 && chunk > 0 )
+	{
+		#pragma omp for schedule(guided, chunk) nowait
+		for( int i = 0; i < n; i++ ) body( i );
+	}
+	else if( KIND == 3 )
+	{
+		#pragma omp for schedule(guided) nowait
+		for( int i = 0; i < n; i++ ) body( i );
+	}
+	else if( KIND == 4 )
+	{
+		#pragma omp for schedule(auto) nowait
+		for( int i = 0; i < n; i++ ) body( i );
+	}
+	else if( chunk > 0 )
+	{
+		#pragma omp for schedule(static, chunk) nowait
+		for( int i = 0; i < n; i++ ) body( i );
+	}
+	else
+	{
+		#pragma omp for schedule(static) nowait
+		for( int i = 0; i < n; i++ ) body( i );
+	}
+}
+
+// Fine grain: one parallel region per body, the team splitting its force sum
+template <int KIND>
+void StepBodyFine( int i, int threads, int chunk )
+{
+	float fx = 0.;
+	float fy = 0.;
+	float fz = 0.;
+	Body *bi = &Bodies[i];
+
+	#pragma omp parallel num_threads(threads) reduction(+:fx,fy,fz)
+	ForEach<KIND>( NumBodies, chunk, [&]( int j ) { if( j != i ) AddForce( bi, &Bodies[j], &fx, &fy, &fz ); } );
+
+	Advance( bi, fx, fy, fz );
+}
+
+/*	The step kernel for grain G and schedule kind KIND. Runs steps steps and
+	returns the average per-thread barrier wait (zero for coarse and fine
+	grain, whose regions join instead). StepDone bookkeeping only happens
+	when record is set, so tuning runs leave no trace. */
+template <int G, int KIND>
+double Steps( int threads, int chunk, int steps, bool record )
+{
+	double sync = 0.;
+
+	if( G < 2 )
+	{
+		for( int t = 0; t < steps; t++ )
+		{
+			if( G == 0 )
+			{
+				#pragma omp parallel num_threads(threads)
+				ForEach<KIND>( NumBodies, chunk, [ ]( int i ) { StepBody( Bodies, NumBodies, i ); } );
+			}
+			else
+			{
+				for( int i = 0; i < NumBodies; i++ )
+					StepBodyFine<KIND>( i, threads, chunk );
+			}
+
+			for( int i = 0; i < NumBodies; i++ )
+				CopyNew( &Bodies[i] );
+
+			if( record ) StepDone( );
+		}
 
-					Body *bj = &Bodies[j];
+		return sync;
+	}
+
+	// One fork/join for the whole run; threads meet at barriers between phases.
+	#pragma omp parallel default(none) shared(Bodies, NumBodies, Ranges, steps, chunk, record) num_threads(threads) reduction(+:sync)
+	{
+		int me = omp_get_thread_num( );
+		int nt = omp_get_num_threads( );
+		double wait = 0.;
+
+		if( G == 3 )
+		{
+			// Static split of the bodies, the starting point for stealing
+			Ranges[me].next = me * NumBodies / nt;
+			Ranges[me].end = (me + 1) * NumBodies / nt;
+			wait += Barrier( );
+		}
+
+		for( int t = 0; t < steps; t++ )
+		{
+			if( G == 2 )
+				ForEach<KIND>( NumBodies, chunk, [ ]( int i ) { StepBody( Bodies, NumBodies, i ); } );
+			else
+				StealBodies( me, nt, chunk );
+			wait += Barrier( );	// Done computing
+
+			{
+				TRACE_SCOPE( "update" );
+				#pragma omp for schedule(static) nowait
+				for( int i = 0; i < NumBodies; i++ )
+					CopyNew( &Bodies[i] );
+			}
+
+			// Nobody is claiming now, so the owner can refill its own range.
+			if( G == 3 ) Ranges[me].next = me * NumBodies / nt;
+			wait += Barrier( );	// Done updating
+
+			// Nobody writes positions again until the next compute barrier.
+			if( record )
+			{
+				#pragma omp master
+				StepDone( );
+			}
+		}
+
+		sync += wait / nt;
+	}
+
+	return sync;
+}
+
+// Steps<grain, kind> for every grain and OMP_SCHED kind; kind 0 is unused
+static const StepsFn STEPS[4][5] =
+{
+	{ NULL, Steps<0, 1>, Steps<0, 2>, Steps<0, 3>, Steps<0, 4> },
+	{ NULL, Steps<1, 1>, Steps<1, 2>, Steps<1, 3>, Steps<1, 4> },
+	{ NULL, Steps<2, 1>, Steps<2, 2>, Steps<2, 3>, Steps<2, 4> },
+	{ NULL, Steps<3, 1>, Steps<3, 1>, Steps<3, 1>, Steps<3, 1> },	// stealing has no schedule kind
+};
+
+/*	Runs steps steps under a runtime configuration and returns the average
+	per-thread barrier wait (zero for coarse and fine grain). */
+double RunSteps( const Tuning *c, int steps, bool record )
+{
+	return STEPS[ c->grain ][ c->kind ]( c->threads, c->chunk, steps, record );
+}
+
+// Cache key: host name, processor count, body count and the thread ceiling
+void TuningKey( char *key, size_t len )
+{
+	char host[128] = "unknown";
+	gethostname( host, sizeof(host) - 1 );
 
-					float rsqd = GetDistanceSquared( bi, bj );
+	snprintf( key, len, "%s/%d/%d/%d", host, omp_get_num_procs( ), NumBodies, NumThreads );
+}
+
+// Finds the most recent cache entry for key. Returns true if there was one.
+bool LoadTuning( const char *key, Tuning *t, double *baseTime )
+{
+	FILE *fp = fopen( TUNECACHE, "r" );
+	if( fp == NULL ) return false;
+
+	char line[512], k[256];
+	Tuning c;
+	double b;
+	bool found = false;
+
+	while( fgets( line, sizeof(line), fp ) != NULL )
+	{
+		if( sscanf( line, "%255s %d %d %d %d %lf %lf", k, &c.threads, &c.grain, &c.kind, &c.chunk, &c.stepTime, &b ) == 7 &&
+			strcmp( k, key ) == 0 && c.threads >= 1 && c.threads <= NumThreads &&
+			( c.grain == 0 || c.grain == 2 || c.grain == 3 ) && c.kind >= 1 && c.kind <= 4 )
+		{
+			*t = c;
+			*baseTime = b;
+			found = true;
+		}
+	}
+
+	fclose( fp );
+	return found;
+}
+
+// Appends a cache entry; later entries for the same key win
+void SaveTuning( const char *key, const Tuning *t, double baseTime )
+{
+	FILE *fp = fopen( TUNECACHE, "a" );
+	if( fp == NULL ) return;
+
+	fprintf( fp, "%s %d %d %d %d %.9lf %.9lf\n", key, t->threads, t->grain, t->kind, t->chunk, t->stepTime, baseTime );
+	fclose( fp );
+}
+
+// Team barrier that returns how long this thread waited at it
+double Barrier( )
+{
+	TRACE_SCOPE( "barrier" );
+	double t0 = omp_get_wtime( );
+	#pragma omp barrier
+	return omp_get_wtime( ) - t0;
+}
+
+/*	Seconds of fork/join overhead for one step that opens nregions
+	parallel regions, measured with empty regions shaped like GRAIN 0/1
+	under c's threads and schedule. */
+double ForkJoinCost( const Tuning *c, int nregions )
+{
+	const int REPS = 1000;
+	float fx = 0.;
+
+	omp_set_schedule( (omp_sched_t) c->kind, c->chunk );
+
+	double t0 = omp_get_wtime( );
+	for( int r = 0; r < REPS; r++ )
+	{
+		#pragma omp parallel for num_threads(c->threads) reduction(+:fx) schedule(runtime)
+		for( int j = 0; j < NumBodies; j++ )
+		{
+			fx += 0.;
+		}
+	}
+	double t1 = omp_get_wtime( );
+
+	return (t1 - t0) / REPS * nregions;
+}
 
-					if( rsqd > 0. )
-					{
-						float f = G * bi->mass * bj->mass / rsqd;
-						float ux, uy, uz;
-						GetUnitVector( bi, bj, &ux, &uy, &uz );
-						fx += f * ux;
-						fy += f * uy;
-						fz += f * uz;
-					}
+/*	Runs systems independent copies of the simulation, each NumBodies large
+	with seed + its index as its seed, and reports the ensemble's combined
+	body-pair throughput. Per-system final states go to ensembleFile. With
+	verbose, lane results are checked against the thread engine. */
+int RunEnsemble( int systems, bool lanes, unsigned int seed, int iterations, int warmup, const char *ensembleFile, bool verbose )
+{
+	int n = NumBodies;
+
+	if( n < 1 )
+	{
+		fprintf( stderr, "Need at least one body\n" );
+		return 1;
+	}
+
+	FILE *fp = fopen( ensembleFile, "w" );
+	if( fp == NULL )
+	{
+		fprintf( stderr, "Cannot open ensemble file %s\n", ensembleFile );
+		return 1;
+	}
+	fprintf( fp, "System,Seed,COM x,COM y,COM z,Kinetic Energy (J)\n" );
+
+	Bench bench( "proj2-ensemble", (double)systems * n * n * NumSteps, warmup, iterations );
+	bool checked = true;
+	bench.config( "systems=%d bodies=%d threads=%d %s", systems, n, NumThreads, lanes ? "lanes" : "thread" );
+	bench.count( NumThreads );
+
+	if( !lanes )
+	{
+		// One whole system per loop iteration, stepped start to finish by one thread
+		Body *all = (Body *) malloc( (size_t)systems * n * sizeof(Body) );
+
+		#pragma omp parallel for default(none) shared(all, systems, n, seed) schedule(static)
+		for( int s = 0; s < systems; s++ )
+			RandomBodies( &all[ (size_t)s * n ], n, seed + s );
+
+		while( bench.next( ) )
+		{
+			#pragma omp parallel for default(none) shared(all, systems, n, NumSteps) schedule(dynamic)
+			for( int s = 0; s < systems; s++ )
+			{
+				for( int t = 0; t < NumSteps; t++ )
+					StepSystem( &all[ (size_t)s * n ], n );
+			}
+		}
+
+		float *state = (float *) malloc( 7 * n * sizeof(float) );
+		for( int s = 0; s < systems; s++ )
+		{
+			Body *b = &all[ (size_t)s * n ];
+			for( int i = 0; i < n; i++ )
+			{
+				state[0*n + i] = b[i].x;
+				state[1*n + i] = b[i].y;
+				state[2*n + i] = b[i].z;
+				state[3*n + i] = b[i].vx;
+				state[4*n + i] = b[i].vy;
+				state[5*n + i] = b[i].vz;
+				state[6*n + i] = b[i].mass;
+			}
+			Summarize( fp, s, seed + s, state, &state[6*n], n );
+		}
+
+		free( state );
+		free( all );
+	}
+	else
+	{
+		// Systems packed LANES at a time; a trailing partial pack runs spare lanes that are not reported
+		int npacks = ( systems + LANES - 1 ) / LANES;
+		size_t len = (size_t)n * LANES;
+		Pack *packs = (Pack *) malloc( npacks * sizeof(Pack) );
+
+		#pragma omp parallel for default(none) shared(packs, npacks, n, len, seed) schedule(static)
+		for( int p = 0; p < npacks; p++ )
+		{
+			float **fields = &packs[p].mass;
+			for( int f = 0; f < 13; f++ )
+				fields[f] = (float *) aligned_alloc( 64, ( len * sizeof(float) + 63 ) & ~(size_t)63 );
+
+			Body *b = (Body *) malloc( n * sizeof(Body) );
+			for( int l = 0; l < LANES; l++ )
+			{
+				RandomBodies( b, n, seed + p*LANES + l );
+				for( int i = 0; i < n; i++ )
+				{
+					packs[p].mass[ i*LANES + l ] = b[i].mass;
+					packs[p].x[ i*LANES + l ] = b[i].x;
+					packs[p].y[ i*LANES + l ] = b[i].y;
+					packs[p].z[ i*LANES + l ] = b[i].z;
+					packs[p].vx[ i*LANES + l ] = b[i].vx;
+					packs[p].vy[ i*LANES + l ] = b[i].vy;
+					packs[p].vz[ i*LANES + l ] = b[i].vz;
 				}
+			}
+			free( b );
+		}
 
-				float ax = fx / Bodies[i].mass;
-				float ay = fy / Bodies[i].mass;
-				float az = fz / Bodies[i].mass;
+		while( bench.next( ) )
+		{
+			#pragma omp parallel for default(none) shared(packs, npacks, n, NumSteps) schedule(dynamic)
+			for( int p = 0; p < npacks; p++ )
+			{
+				for( int t = 0; t < NumSteps; t++ )
+					StepPack( &packs[p], n );
+			}
+		}
 
-				Bodies[i].xnew = Bodies[i].x + Bodies[i].vx*TIMESTEP + 0.5*ax*TIMESTEP*TIMESTEP;
-				Bodies[i].ynew = Bodies[i].y + Bodies[i].vy*TIMESTEP + 0.5*ay*TIMESTEP*TIMESTEP;
-				Bodies[i].znew = Bodies[i].z + Bodies[i].vz*TIMESTEP + 0.5*az*TIMESTEP*TIMESTEP;
+		float *state = (float *) malloc( 7 * n * sizeof(float) );
+		Body *ref = verbose ? (Body *) malloc( n * sizeof(Body) ) : NULL;
+		double worst = 0.;
+		for( int s = 0; s < systems; s++ )
+		{
+			Pack *pk = &packs[ s / LANES ];
+			int l = s % LANES;
+			for( int i = 0; i < n; i++ )
+			{
+				state[0*n + i] = pk->x[ i*LANES + l ];
+				state[1*n + i] = pk->y[ i*LANES + l ];
+				state[2*n + i] = pk->z[ i*LANES + l ];
+				state[3*n + i] = pk->vx[ i*LANES + l ];
+				state[4*n + i] = pk->vy[ i*LANES + l ];
+				state[5*n + i] = pk->vz[ i*LANES + l ];
+				state[6*n + i] = pk->mass[ i*LANES + l ];
+			}
+			Summarize( fp, s, seed + s, state, &state[6*n], n );
 
-				Bodies[i].vxnew = Bodies[i].vx + ax*TIMESTEP;
-				Bodies[i].vynew = Bodies[i].vy + ay*TIMESTEP;
-				Bodies[i].vznew = Bodies[i].vz + az*TIMESTEP;
+			if( ref != NULL )
+			{
+				// The lanes sum accelerations, StepBody forces, so they agree to rounding
+				RandomBodies( ref, n, seed + s );
+				for( int r = 0; r < bench.runs( ) * NumSteps; r++ )
+					StepSystem( ref, n );
+
+				// Positions and velocities, each relative to its largest component
+				double dp = 0., sp = 0., dv = 0., sv = 0.;
+				for( int i = 0; i < n; i++ )
+				{
+					dp = fmax( dp, fmax( fabs( state[0*n + i] - ref[i].x ), fmax( fabs( state[1*n + i] - ref[i].y ), fabs( state[2*n + i] - ref[i].z ) ) ) );
+					sp = fmax( sp, fmax( fabs( ref[i].x ), fmax( fabs( ref[i].y ), fabs( ref[i].z ) ) ) );
+					dv = fmax( dv, fmax( fabs( state[3*n + i] - ref[i].vx ), fmax( fabs( state[4*n + i] - ref[i].vy ), fabs( state[5*n + i] - ref[i].vz ) ) ) );
+					sv = fmax( sv, fmax( fabs( ref[i].vx ), fmax( fabs( ref[i].vy ), fabs( ref[i].vz ) ) ) );
+				}
+				worst = fmax( worst, fmax( sp > 0. ? dp / sp : dp, sv > 0. ? dv / sv : dv ) );
 			}
+		}
+		free( state );
 
-			// setup the state for the next animation step:
-		 
-			for( int i = 0; i < NUMBODIES; i++ )
+		if( ref != NULL )
+		{
+			fprintf( stderr, "Lanes check: positions and velocities within %.3g of the thread engine, relative to the largest of each\n", worst );
+			free( ref );
+			if( !( worst <= LANESTOL ) )
 			{
-			  Bodies[i].x = Bodies[i].xnew;
-			  Bodies[i].y = Bodies[i].ynew;
-			  Bodies[i].z = Bodies[i].znew;
-			  Bodies[i].vx = Bodies[i].vxnew;
-			  Bodies[i].vy = Bodies[i].vynew;
-			  Bodies[i].vz = Bodies[i].vznew;
+				fprintf( stderr, "Lanes check failed: more than %g off\n", LANESTOL );
+				checked = false;
 			}
+		}
+
+		for( int p = 0; p < npacks; p++ )
+		{
+			float **fields = &packs[p].mass;
+			for( int f = 0; f < 13; f++ )
+				free( fields[f] );
+		}
+		free( packs );
+	}
 
-		}  // t
+	fclose( fp );
 
-		double time1 = omp_get_wtime( );
+	const BenchStats &stats = bench.stats( );
+	bench.report( );
 
-		tAvg += time1 - time0;
+	// Same unit as the single-system run: millions of body pairs per second, summed over systems
+	fprintf( stdout, "%d,%d,%d,%s,%lf,%lf", NumThreads, systems, n, lanes ? "lanes" : "thread",
+		bench.mrate( stats.mean ), bench.mrate( stats.min ) );
+	bench.counterColumns( stdout );
+	fprintf( stdout, "\n" );
 
-		if (time1 - time0 < tMin) tMin = time1 - time0;
+	return checked ? 0 : 1;
+}
 
+/*	Runs one NumBodies system split over procs processes, rank 0 being
+	this one and the rest forked from it. Rank r owns bodies
+	[ r*n/procs, (r+1)*n/procs ) and every step sees the others' pass by
+	around the ring (RingStep). Rank 0 times the runs and prints the CSV
+	line; with verbose it also gathers the final positions and compares
+	them with a one-process run of as many steps. */
+int RunRing( int procs, int kind, unsigned int seed, int iterations, int warmup, bool verbose )
+{
+	int n = NumBodies;
+	if( n < procs )
+	{
+		fprintf( stderr, "Need at least one body per process\n" );
+		return 1;
 	}
 
-	tAvg /= ITERATIONS;
+	int most = ( n + procs - 1 ) / procs;
+	size_t bytes = sizeof(RingBlock) + most * sizeof(Source);
+	Transport *t = TransportCreate( kind, procs, bytes );
+	if( t == NULL )
+	{
+		fprintf( stderr, "Cannot set up the %s transport for %d processes\n", TRANSPORTNAMES[kind], procs );
+		return 1;
+	}
 
-	float MbpsAvg = (float) (NUMBODIES * NUMBODIES * NUMSTEPS) / tAvg / 1000000.;
-	float MbpsPeak = (float) (NUMBODIES * NUMBODIES * NUMSTEPS) / tMin / 1000000.;
+	// stdout is flushed first so the children do not inherit and repeat buffered output
+	fflush( stdout );
+	int rank = 0;
+	pid_t *children = (pid_t *) malloc( procs * sizeof(pid_t) );
+	for( int r = 1; r < procs; r++ )
+	{
+		children[r] = fork( );
+		if( children[r] == 0 )
+		{
+			rank = r;
+			break;
+		}
+		if( children[r] < 0 )
+		{
+			perror( "fork" );
+			exit( 1 );
+		}
+	}
+	TransportJoin( t, rank );
 
-	// Print results as csv.
-	fprintf( stdout, "%d,%lf,%lf", NUMTHREADS, MbpsAvg, MbpsPeak);
+	int lo = (int)( (long) rank * n / procs ), hi = (int)( (long)( rank + 1 ) * n / procs );
+	int m = hi - lo;
+	Body *all = (Body *) malloc( n * sizeof(Body) );
+	RandomBodies( all, n, seed );
+	Body *mine = (Body *) malloc( m * sizeof(Body) );
+	memcpy( mine, &all[lo], m * sizeof(Body) );
 
-	#if OMP_SCHED == 1
-		fprintf( stdout, ",static" );
-	#elif OMP_SCHED == 2
-		fprintf( stdout, ",dynamic" );
-	#elif OMP_SCHED == 3
-		fprintf( stdout, ",guided" );
-	#elif OMP_SCHED == 4
-		fprintf( stdout, ",auto" );
-	#else
-		fprintf( stdout, ",static" );
-	#endif
+	char *blocks[2] = { (char *) malloc( bytes ), (char *) malloc( bytes ) };
 
-	#if GRAIN == 1
-		fprintf( stdout, ",fine");
-	#else
-		fprintf( stdout, ",coarse");
-	#endif
+	// Every rank runs as many times; only rank 0's times and counters are kept
+	Bench bench( "proj2-ring", (double)n * n * NumSteps, warmup, iterations );
+	bench.config( "bodies=%d procs=%d threads=%d transport=%s", n, procs, NumThreads, TRANSPORTNAMES[kind] );
+	if( rank == 0 ) bench.count( NumThreads );
 
-	fprintf( stdout, "\n");
-	
-	return 0;
+	while( bench.next( ) )
+	{
+		for( int s = 0; s < NumSteps; s++ )
+			RingStep( t, mine, m, blocks, bytes );
+	}
+
+	Source *final = rank == 0 && verbose ? (Source *) malloc( 2 * n * sizeof(Source) ) : NULL;
+	if( verbose )
+	{
+		RingGather( t, mine, m, blocks, bytes, final, false );
+		RingGather( t, mine, m, blocks, bytes, final == NULL ? NULL : &final[n], true );
+	}
+
+	double waitTime = t->waitTime;
+	TransportClose( t );
+	free( blocks[0] );
+	free( blocks[1] );
+	free( mine );
+
+	if( rank != 0 )
+	{
+		// Skips the exit handlers, which belong to rank 0
+		free( all );
+		_exit( 0 );
+	}
+
+	int failed = 0;
+	for( int r = 1; r < procs; r++ )
+	{
+		int status;
+		if( waitpid( children[r], &status, 0 ) < 0 || !WIFEXITED( status ) || WEXITSTATUS( status ) != 0 ) failed++;
+	}
+	free( children );
+	if( failed > 0 ) fprintf( stderr, "%d ring processes failed\n", failed );
+
+	const BenchStats &stats = bench.stats( );
+	bench.report( );
+
+	// Same unit as the one-process run; the wait is the part of each step's exchanges that computing did not hide
+	fprintf( stdout, "%d,%d,%d,%s,%lf,%lf,%lf", procs, n, NumThreads, TRANSPORTNAMES[kind],
+		bench.mrate( stats.mean ), bench.mrate( stats.min ), waitTime / bench.runs( ) / NumSteps * 1000000. );
+	bench.counterColumns( stdout );
+	fprintf( stdout, "\n" );
+
+	bool checked = true;
+	if( final != NULL )
+	{
+		// The reference sums each body's forces in index order, the ring in ring order, so they agree to rounding
+		for( int r = 0; r < bench.runs( ) * NumSteps; r++ )
+			StepSystem( all, n );
+
+		// Positions and velocities, each relative to its largest component: the velocities carry the force error first
+		const Source *v = &final[n];
+		double dp = 0., sp = 0., dv = 0., sv = 0.;
+		for( int i = 0; i < n; i++ )
+		{
+			dp = fmax( dp, fmax( fabs( final[i].x - all[i].x ), fmax( fabs( final[i].y - all[i].y ), fabs( final[i].z - all[i].z ) ) ) );
+			sp = fmax( sp, fmax( fabs( all[i].x ), fmax( fabs( all[i].y ), fabs( all[i].z ) ) ) );
+			dv = fmax( dv, fmax( fabs( v[i].x - all[i].vx ), fmax( fabs( v[i].y - all[i].vy ), fabs( v[i].z - all[i].vz ) ) ) );
+			sv = fmax( sv, fmax( fabs( all[i].vx ), fmax( fabs( all[i].vy ), fabs( all[i].vz ) ) ) );
+		}
+		double worst = fmax( sp > 0. ? dp / sp : dp, sv > 0. ? dv / sv : dv );
+		fprintf( stderr, "Ring check: positions and velocities within %.3g of a one-process run, relative to the largest of each\n", worst );
+		free( final );
+
+		if( !( worst <= RINGTOL ) )
+		{
+			fprintf( stderr, "Ring check failed: more than %g off\n", RINGTOL );
+			checked = false;
+		}
+	}
+
+	free( all );
+	return failed > 0 || !checked ? 1 : 0;
+}
+
+/*	One step of this rank's m bodies: its own block starts around the
+	ring, and while the background thread passes the current block on and
+	fetches the next, the team adds the current block's pull to every
+	body. After size blocks every body has felt every other and moves. */
+void RingStep( Transport *t, Body *mine, int m, char **blocks, size_t bytes )
+{
+	RingBlock *h = (RingBlock *) blocks[0];
+	Source *src = (Source *)( h + 1 );
+	h->owner = t->rank;
+	h->count = m;
+	for( int i = 0; i < m; i++ )
+	{
+		src[i] = Source{ mine[i].x, mine[i].y, mine[i].z, mine[i].mass };
+		mine[i].fx = mine[i].fy = mine[i].fz = 0.;
+	}
+
+	int cur = 0;
+	for( int k = 0; k < t->size; k++ )
+	{
+		bool more = k < t->size - 1;
+		if( more ) TransportStart( t, blocks[cur], blocks[1 - cur], bytes );
+
+		const RingBlock *b = (const RingBlock *) blocks[cur];
+		const Source *s = (const Source *)( b + 1 );
+		int count = b->count;
+		bool self = b->owner == t->rank;
+
+		#pragma omp parallel default(none) shared(mine, m, s, count, self)
+		{
+			TRACE_SCOPE( "forces" );
+
+			#pragma omp for schedule(static) nowait
+			for( int i = 0; i < m; i++ )
+			{
+				Body *bi = &mine[i];
+				float fx = bi->fx, fy = bi->fy, fz = bi->fz;
+				for( int j = 0; j < count; j++ )
+				{
+					if( self && j == i ) continue;
+
+					Body bj;
+					bj.x = s[j].x;
+					bj.y = s[j].y;
+					bj.z = s[j].z;
+					bj.mass = s[j].mass;
+					AddForce( bi, &bj, &fx, &fy, &fz );
+				}
+				bi->fx = fx;
+				bi->fy = fy;
+				bi->fz = fz;
+			}
+		}
+
+		if( more )
+		{
+			TRACE_SCOPE( "ring wait" );
+			TransportFinish( t );
+			cur = 1 - cur;
+		}
+	}
+
+	#pragma omp parallel for default(none) shared(mine, m) schedule(static)
+	for( int i = 0; i < m; i++ )
+	{
+		Advance( &mine[i], mine[i].fx, mine[i].fy, mine[i].fz );
+		CopyNew( &mine[i] );
+	}
+}
+
+/*	Passes every rank's final positions, or with velocities its
+	velocities in x, y and z, around the ring once; rank 0 copies each
+	block into all, indexed like the one-process bodies. Every rank must
+	call it; all is only used on rank 0. */
+void RingGather( Transport *t, Body *mine, int m, char **blocks, size_t bytes, Source *all, bool velocities )
+{
+	RingBlock *h = (RingBlock *) blocks[0];
+	Source *src = (Source *)( h + 1 );
+	h->owner = t->rank;
+	h->count = m;
+	for( int i = 0; i < m; i++ )
+		src[i] = velocities ? Source{ mine[i].vx, mine[i].vy, mine[i].vz, mine[i].mass } : Source{ mine[i].x, mine[i].y, mine[i].z, mine[i].mass };
 
+	int cur = 0, n = NumBodies;
+	for( int k = 0; k < t->size; k++ )
+	{
+		if( t->rank == 0 )
+		{
+			const RingBlock *b = (const RingBlock *) blocks[cur];
+			int lo = (int)( (long) b->owner * n / t->size );
+			memcpy( &all[lo], b + 1, b->count * sizeof(Source) );
+		}
+
+		if( k < t->size - 1 )
+		{
+			TransportShift( t, blocks[cur], blocks[1 - cur], bytes );
+			cur = 1 - cur;
+		}
+	}
+}
+
+// Advances one small system by a step on the calling thread
+void StepSystem( Body *bodies, int n )
+{
+	for( int i = 0; i < n; i++ )
+		StepBody( bodies, n, i );
+
+	for( int i = 0; i < n; i++ )
+	{
+		bodies[i].x = bodies[i].xnew;
+		bodies[i].y = bodies[i].ynew;
+		bodies[i].z = bodies[i].znew;
+		bodies[i].vx = bodies[i].vxnew;
+		bodies[i].vy = bodies[i].vynew;
+		bodies[i].vz = bodies[i].vznew;
+	}
 }
 
+/*	Advances all LANES systems of a pack by a step. Same arithmetic as
+	StepBody in single precision, with the lane loop innermost so it
+	vectorizes; -v checks it against StepSystem. */
+void StepPack( Pack *pk, int n )
+{
+	const float *mass = pk->mass;
+	const float *x = pk->x, *y = pk->y, *z = pk->z;
+	const float *vx = pk->vx, *vy = pk->vy, *vz = pk->vz;
+	const float g = G;	// keep the pair loop in single precision
+
+	for( int i = 0; i < n; i++ )
+	{
+		// Sums accelerations, not forces: G m_i m_j is past FLT_MAX, G m_j is not
+		const int bi = i*LANES;
+		float ax[LANES] = { 0. };
+		float ay[LANES] = { 0. };
+		float az[LANES] = { 0. };
+
+		for( int j = 0; j < n; j++ )
+		{
+			if( j == i ) continue;
+
+			const int bj = j*LANES;
+
+			#pragma omp simd
+			for( int l = 0; l < LANES; l++ )
+			{
+				float dx = x[bj+l] - x[bi+l];
+				float dy = y[bj+l] - y[bi+l];
+				float dz = z[bj+l] - z[bi+l];
+				float rsqd = dx*dx + dy*dy + dz*dz;
+				float d = sqrtf( rsqd );
+				float a = rsqd > 0.f ? g * mass[bj+l] / rsqd / d : 0.f;
+				ax[l] += a * dx;
+				ay[l] += a * dy;
+				az[l] += a * dz;
+			}
+		}
+
+		#pragma omp simd
+		for( int l = 0; l < LANES; l++ )
+		{
+			pk->xnew[bi+l] = x[bi+l] + vx[bi+l]*TIMESTEP + 0.5*ax[l]*TIMESTEP*TIMESTEP;
+			pk->ynew[bi+l] = y[bi+l] + vy[bi+l]*TIMESTEP + 0.5*ay[l]*TIMESTEP*TIMESTEP;
+			pk->znew[bi+l] = z[bi+l] + vz[bi+l]*TIMESTEP + 0.5*az[l]*TIMESTEP*TIMESTEP;
+
+			pk->vxnew[bi+l] = vx[bi+l] + ax[l]*TIMESTEP;
+			pk->vynew[bi+l] = vy[bi+l] + ay[l]*TIMESTEP;
+			pk->vznew[bi+l] = vz[bi+l] + az[l]*TIMESTEP;
+		}
+	}
+
+	// setup the state for the next step by swapping old and new arrays
+	float *tmp;
+	tmp = pk->x;  pk->x = pk->xnew;   pk->xnew = tmp;
+	tmp = pk->y;  pk->y = pk->ynew;   pk->ynew = tmp;
+	tmp = pk->z;  pk->z = pk->znew;   pk->znew = tmp;
+	tmp = pk->vx; pk->vx = pk->vxnew; pk->vxnew = tmp;
+	tmp = pk->vy; pk->vy = pk->vynew; pk->vynew = tmp;
+	tmp = pk->vz; pk->vz = pk->vznew; pk->vznew = tmp;
+}
+
+// Writes one system's center of mass and kinetic energy from SoA state
+void Summarize( FILE *fp, int system, unsigned int seed, const float *s, const float *mass, int n )
+{
+	double m = 0., cx = 0., cy = 0., cz = 0., ke = 0.;
+
+	for( int i = 0; i < n; i++ )
+	{
+		double mi = mass[i];
+		double vx = s[3*n + i], vy = s[4*n + i], vz = s[5*n + i];
+
+		m += mi;
+		cx += mi * s[0*n + i];
+		cy += mi * s[1*n + i];
+		cz += mi * s[2*n + i];
+		ke += 0.5 * mi * ( vx*vx + vy*vy + vz*vz );
+	}
+
+	fprintf( fp, "%d,%u,%e,%e,%e,%e\n", system, seed, cx/m, cy/m, cz/m, ke );
+}
 
 float GetDistanceSquared( Body *bi, Body *bj )
 {
@@ -254,15 +1443,63 @@ float GetUnitVector( Body *from, Body *to, float *ux, float *uy, float *uz )
 	return d;
 }
 
-float Ranf( float low, float high )
+/*	Fills n fresh bodies in parallel. Body i takes its seven values from
+	Philox stream i, so the result depends only on the seed and not on
+	the thread count or the order bodies are visited in. */
+void RandomBodies( Body *bodies, int n, unsigned int seed )
 {
-	float r = (float) rand();         // 0 - RAND_MAX
-	return(   low  +  r * ( high - low ) / (float)RAND_MAX   );
+	#pragma omp parallel for default(none) shared(bodies, n, seed) schedule(static)
+	for( int i = 0; i < n; i++ )
+	{
+		float m, r[6];
+		PhiloxFill( seed, i, 0, &m, 1, 0.5f, 10.f );
+		PhiloxFill( seed, i, 1, r, 6, -100.f, 100.f );
+
+		Body *b = &bodies[i];
+		b->mass = EARTH_MASS  * m;
+		b->x = EARTH_DIAMETER * r[0];
+		b->y = EARTH_DIAMETER * r[1];
+		b->z = EARTH_DIAMETER * r[2];
+		b->vx = r[3];
+		b->vy = r[4];
+		b->vz = r[5];
+	}
 }
 
-int Ranf( int ilow, int ihigh )
+/*	Sets NumBodies and Bodies from the last frame of a trajectory file.
+	Returns 0 on success. */
+int LoadBodies( const char *path )
 {
-	float low = (float)ilow;
-	float high = (float)ihigh + 0.9999f;
-	return (int)(  Ranf(low,high) );
+	TrajFile tf;
+	if( TrajOpen( path, &tf ) != 0 ) return -1;
+
+	if( tf.numFrames < 1 )
+	{
+		TrajRelease( &tf );
+		return -1;
+	}
+
+	NumBodies = tf.header->numBodies;
+	Bodies = (Body *) malloc( NumBodies * sizeof(Body) );
+
+	const float *s = TrajState( &tf, tf.numFrames - 1 );
+	const float *mass = tf.mass;
+	int n = NumBodies;
+
+	#pragma omp parallel for default(none) shared(Bodies, s, mass, n) schedule(static)
+	for( int i = 0; i < n; i++ )
+	{
+		Body *b = &Bodies[i];
+		b->mass = mass[i];
+		b->x = s[0*n + i];
+		b->y = s[1*n + i];
+		b->z = s[2*n + i];
+		b->vx = s[3*n + i];
+		b->vy = s[4*n + i];
+		b->vz = s[5*n + i];
+	}
+
+	TrajRelease( &tf );
+
+	return 0;
 }
@@ -0,0 +1,215 @@
+#include "traj.h"
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+
+// Bytes in one frame: step counter plus SoA state, rounded up to 8
+int64_t
+TrajFrameBytes( int numBodies )
+{
+	int64_t bytes = sizeof(int64_t) + (int64_t)TRAJ_FIELDS * numBodies * sizeof(float);
+	return ( bytes + 7 ) & ~(int64_t)7;
+}
+
+// Bytes in the mass block that follows the header, rounded up to 8
+size_t
+TrajMassBytes( int numBodies )
+{
+	return ( numBodies * sizeof(float) + 7 ) & ~(size_t)7;
+}
+
+// Monotonic seconds, for timing stalls without pulling in OpenMP
+static double
+TrajSeconds( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Background thread: write out full buffers in the order they were filled
+static void *
+TrajThread( void *arg )
+{
+	TrajWriter *w = (TrajWriter *) arg;
+	int b = 0;
+
+	pthread_mutex_lock( &w->lock );
+	for( ;; )
+	{
+		while( !w->full[b] && !w->done )
+			pthread_cond_wait( &w->cond, &w->lock );
+
+		if( !w->full[b] ) break;	// done and nothing left
+
+		// Write without holding the lock so the simulation can fill the other buffer.
+		pthread_mutex_unlock( &w->lock );
+		fwrite( w->buf[b], w->frameBytes, 1, w->fp );
+		pthread_mutex_lock( &w->lock );
+
+		w->full[b] = 0;
+		pthread_cond_broadcast( &w->cond );
+		b = 1 - b;
+	}
+	pthread_mutex_unlock( &w->lock );
+
+	return NULL;
+}
+
+// Opens path, writes the header and masses and starts the writer thread
+TrajWriter *
+TrajCreate( const char *path, int numBodies, int snapEvery, double timestep, const float *mass )
+{
+	FILE *fp = fopen( path, "wb" );
+	if( fp == NULL ) return NULL;
+
+	TrajWriter *w = (TrajWriter *) calloc( 1, sizeof(TrajWriter) );
+	w->fp = fp;
+	w->numBodies = numBodies;
+	w->frameBytes = TrajFrameBytes( numBodies );
+	w->buf[0] = (char *) calloc( 1, w->frameBytes );
+	w->buf[1] = (char *) calloc( 1, w->frameBytes );
+
+	TrajHeader h;
+	memset( &h, 0, sizeof(h) );
+	memcpy( h.magic, TRAJ_MAGIC, sizeof(h.magic) );
+	h.numBodies = numBodies;
+	h.snapEvery = snapEvery;
+	h.timestep = timestep;
+	h.frameBytes = w->frameBytes;
+	fwrite( &h, sizeof(h), 1, fp );
+
+	char *m = (char *) calloc( 1, TrajMassBytes( numBodies ) );
+	memcpy( m, mass, numBodies * sizeof(float) );
+	fwrite( m, TrajMassBytes( numBodies ), 1, fp );
+	free( m );
+
+	pthread_mutex_init( &w->lock, NULL );
+	pthread_cond_init( &w->cond, NULL );
+	pthread_create( &w->thread, NULL, TrajThread, w );
+
+	return w;
+}
+
+/*	Returns the SoA state block of the next free buffer, waiting if the
+	writer still holds both. Fill it, then call TrajCommit. */
+float *
+TrajBegin( TrajWriter *w, int64_t step )
+{
+	int b = w->fill;
+
+	pthread_mutex_lock( &w->lock );
+	if( w->full[b] )
+	{
+		double t0 = TrajSeconds( );
+		while( w->full[b] )
+			pthread_cond_wait( &w->cond, &w->lock );
+		w->stalls++;
+		w->stallTime += TrajSeconds( ) - t0;
+	}
+	pthread_mutex_unlock( &w->lock );
+
+	memcpy( w->buf[b], &step, sizeof(step) );
+	return (float *)( w->buf[b] + sizeof(int64_t) );
+}
+
+// Hands the buffer filled since TrajBegin to the writer thread
+void
+TrajCommit( TrajWriter *w )
+{
+	pthread_mutex_lock( &w->lock );
+	w->full[w->fill] = 1;
+	w->frames++;
+	pthread_cond_broadcast( &w->cond );
+	pthread_mutex_unlock( &w->lock );
+
+	w->fill = 1 - w->fill;
+}
+
+// Drains outstanding frames, stops the writer and closes the file
+void
+TrajClose( TrajWriter *w )
+{
+	pthread_mutex_lock( &w->lock );
+	w->done = 1;
+	pthread_cond_broadcast( &w->cond );
+	pthread_mutex_unlock( &w->lock );
+
+	pthread_join( w->thread, NULL );
+	fclose( w->fp );
+
+	pthread_mutex_destroy( &w->lock );
+	pthread_cond_destroy( &w->cond );
+	free( w->buf[0] );
+	free( w->buf[1] );
+	free( w );
+}
+
+// Maps a trajectory file read-only. Returns 0 on success.
+int
+TrajOpen( const char *path, TrajFile *tf )
+{
+	memset( tf, 0, sizeof(*tf) );
+
+	int fd = open( path, O_RDONLY );
+	if( fd < 0 ) return -1;
+
+	struct stat st;
+	if( fstat( fd, &st ) != 0 || (size_t)st.st_size < sizeof(TrajHeader) )
+	{
+		close( fd );
+		return -1;
+	}
+
+	void *map = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+	close( fd );
+	if( map == MAP_FAILED ) return -1;
+
+	const TrajHeader *h = (const TrajHeader *) map;
+	size_t start = sizeof(TrajHeader) + TrajMassBytes( h->numBodies );
+
+	if( memcmp( h->magic, TRAJ_MAGIC, sizeof(h->magic) ) != 0 || h->numBodies <= 0 ||
+		h->frameBytes != TrajFrameBytes( h->numBodies ) || (size_t)st.st_size < start )
+	{
+		munmap( map, st.st_size );
+		return -1;
+	}
+
+	tf->map = map;
+	tf->size = st.st_size;
+	tf->header = h;
+	tf->mass = (const float *)( (const char *) map + sizeof(TrajHeader) );
+	tf->frames = (const char *) map + start;
+	tf->numFrames = ( st.st_size - start ) / h->frameBytes;
+
+	return 0;
+}
+
+// Step number recorded in frame f
+int64_t
+TrajStep( const TrajFile *tf, long f )
+{
+	int64_t step;
+	memcpy( &step, tf->frames + f * tf->header->frameBytes, sizeof(step) );
+	return step;
+}
+
+/*	SoA state of frame f: field k of body i is at [k*numBodies + i],
+	with fields ordered x, y, z, vx, vy, vz. */
+const float *
+TrajState( const TrajFile *tf, long f )
+{
+	return (const float *)( tf->frames + f * tf->header->frameBytes + sizeof(int64_t) );
+}
+
+void
+TrajRelease( TrajFile *tf )
+{
+	if( tf->map != NULL ) munmap( tf->map, tf->size );
+	memset( tf, 0, sizeof(*tf) );
+}
@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#ifndef TRAJ_H
+#define TRAJ_H
+
+/*	Binary trajectory file layout (native byte order):
+
+	TrajHeader
+	float mass[numBodies], zero padded to a multiple of 8 bytes
+	frame 0, frame 1, ... each frameBytes long:
+		int64_t step
+		float x[N], y[N], z[N], vx[N], vy[N], vz[N]	(SoA)
+		zero padding to a multiple of 8 bytes
+
+	Every piece has a fixed size, so a reader can mmap the file and index
+	frames directly. The frame count comes from the file size, which means
+	a file that is still being written can be read up to its last full frame.
+*/
+
+#define TRAJ_MAGIC		"NBTRAJ01"
+#define TRAJ_FIELDS		6		// x, y, z, vx, vy, vz
+
+struct trajheader
+{
+	char magic[8];
+	int32_t numBodies;
+	int32_t snapEvery;		// steps between frames
+	double timestep;		// seconds per step
+	int64_t frameBytes;
+};
+
+typedef struct trajheader TrajHeader;
+
+/*	Asynchronous writer. The simulation fills one of two frame buffers while
+	a background thread writes the other one out, so compute threads only
+	ever pay for a memcpy-sized snapshot unless the disk falls two frames behind.
+*/
+struct trajwriter
+{
+	FILE *fp;
+	int numBodies;
+	int64_t frameBytes;
+
+	char *buf[2];			// whole frames, step + SoA state
+	int full[2];			// set when a buffer is waiting to be written
+	int fill;				// buffer the simulation fills next
+	int done;
+
+	long frames;			// frames handed to the writer
+	long stalls;			// snapshots that had to wait for a free buffer
+	double stallTime;		// seconds spent waiting
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+typedef struct trajwriter TrajWriter;
+
+// Reader view of an mmap'd trajectory file
+struct trajfile
+{
+	void *map;
+	size_t size;
+	const TrajHeader *header;
+	const float *mass;
+	const char *frames;
+	long numFrames;
+};
+
+typedef struct trajfile TrajFile;
+
+int64_t		TrajFrameBytes( int );
+size_t		TrajMassBytes( int );
+
+TrajWriter *TrajCreate( const char *, int, int, double, const float * );
+float *		TrajBegin( TrajWriter *, int64_t );
+void		TrajCommit( TrajWriter * );
+void		TrajClose( TrajWriter * );
+
+int			TrajOpen( const char *, TrajFile * );
+int64_t		TrajStep( const TrajFile *, long );
+const float *TrajState( const TrajFile *, long );
+void		TrajRelease( TrajFile * );
+
+
+#endif		// TRAJ_H
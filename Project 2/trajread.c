@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "traj.h"
+
+/*	Reads a proj2 trajectory file.
+
+	trajread <file>				one CSV line per frame: step, center of mass, kinetic energy
+	trajread <file> <frame>		one CSV line per body of the given frame (negative counts from the end)
+
+	Build as: gcc trajread.c traj.c -o trajread -lm -pthread
+*/
+
+void PrintSummary( TrajFile * );
+void PrintFrame( TrajFile *, long );
+
+int main( int argc, char *argv[ ] )
+{
+	if( argc != 2 && argc != 3 )
+	{
+		fprintf( stderr, "Invalid syntax. Try %s <trajFile> [frame]\n", argv[0] );
+		return 1;
+	}
+
+	TrajFile tf;
+	if( TrajOpen( argv[1], &tf ) != 0 )
+	{
+		fprintf( stderr, "%s is not a readable trajectory file\n", argv[1] );
+		return 1;
+	}
+
+	fprintf( stderr, "%s: %d bodies, %ld frames, a frame every %d steps of %lf sec\n", argv[1],
+		tf.header->numBodies, tf.numFrames, tf.header->snapEvery, tf.header->timestep );
+
+	if( argc == 2 )
+	{
+		PrintSummary( &tf );
+	}
+	else
+	{
+		long f = atol( argv[2] );
+		if( f < 0 ) f += tf.numFrames;
+
+		if( f < 0 || f >= tf.numFrames )
+		{
+			fprintf( stderr, "Frame %s is out of range\n", argv[2] );
+			TrajRelease( &tf );
+			return 1;
+		}
+		PrintFrame( &tf, f );
+	}
+
+	TrajRelease( &tf );
+
+	return 0;
+}
+
+// Center of mass and total kinetic energy of every frame
+void PrintSummary( TrajFile *tf )
+{
+	int n = tf->header->numBodies;
+
+	fprintf( stdout, "Step,Time (s),COM x,COM y,COM z,Kinetic Energy (J)\n" );
+
+	for( long f = 0; f < tf->numFrames; f++ )
+	{
+		const float *s = TrajState( tf, f );
+		double m = 0., cx = 0., cy = 0., cz = 0., ke = 0.;
+
+		for( int i = 0; i < n; i++ )
+		{
+			double mi = tf->mass[i];
+			double vx = s[3*n + i], vy = s[4*n + i], vz = s[5*n + i];
+
+			m += mi;
+			cx += mi * s[0*n + i];
+			cy += mi * s[1*n + i];
+			cz += mi * s[2*n + i];
+			ke += 0.5 * mi * ( vx*vx + vy*vy + vz*vz );
+		}
+
+		long long step = TrajStep( tf, f );
+		fprintf( stdout, "%lld,%lf,%e,%e,%e,%e\n", step, step * tf->header->timestep, cx/m, cy/m, cz/m, ke );
+	}
+}
+
+// Full state of one frame
+void PrintFrame( TrajFile *tf, long f )
+{
+	int n = tf->header->numBodies;
+	const float *s = TrajState( tf, f );
+
+	fprintf( stdout, "Step,Body,Mass,x,y,z,vx,vy,vz\n" );
+
+	for( int i = 0; i < n; i++ )
+	{
+		fprintf( stdout, "%lld,%d,%e,%e,%e,%e,%e,%e,%e\n", (long long) TrajStep( tf, f ), i, tf->mass[i],
+			s[0*n + i], s[1*n + i], s[2*n + i], s[3*n + i], s[4*n + i], s[5*n + i] );
+	}
+}
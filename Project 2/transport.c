@@ -0,0 +1,303 @@
+#ifndef _GNU_SOURCE
+	#define _GNU_SOURCE	// sched_yield
+#endif
+#include "transport.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <omp.h>
+
+
+const char *TRANSPORTNAMES[NUMTRANSPORTS] = { "shm", "socket" };
+
+// Polls between sched_yield( )s while a shm link is not ready
+#define TRANSPORTYIELD 16
+
+// One poll of a spin loop: pause, and give up the CPU now and then
+static inline void
+Poll( unsigned int *polls )
+{
+	#if defined( __x86_64__ ) || defined( __i386__ )
+		__builtin_ia32_pause( );
+	#endif
+	if( ++*polls % TRANSPORTYIELD == 0 ) sched_yield( );
+}
+
+
+/*	shm: link l carries rank l's messages to rank l + 1. seq counts
+	messages written and ack messages taken, each on its own cache line,
+	followed by a maxBytes slot. */
+struct shmlink
+{
+	uint64_t seq __attribute__((aligned(64)));
+	uint64_t ack __attribute__((aligned(64)));
+	char data[] __attribute__((aligned(64)));
+};
+
+typedef struct shmlink ShmLink;
+
+struct shm
+{
+	char *map;
+	size_t stride;		// bytes from one link to the next
+	size_t length;		// of the whole mapping
+};
+
+typedef struct shm Shm;
+
+static ShmLink *
+ShmLinkOf( Transport *t, int l )
+{
+	Shm *s = (Shm *) t->impl;
+	return (ShmLink *)( s->map + (size_t)l * s->stride );
+}
+
+// Every process maps every link, so there is nothing to drop
+static void
+ShmJoin( Transport *t, int rank )
+{
+	(void) t;
+	(void) rank;
+}
+
+static void
+ShmShift( Transport *t, const void *out, void *in, size_t bytes )
+{
+	ShmLink *o = ShmLinkOf( t, t->rank );
+	ShmLink *i = ShmLinkOf( t, ( t->rank + t->size - 1 ) % t->size );
+	unsigned int polls = 0;
+
+	// Only this rank writes seq on its outgoing link, so it can read it plainly
+	while( __atomic_load_n( &o->ack, __ATOMIC_ACQUIRE ) != o->seq )
+		Poll( &polls );
+	memcpy( o->data, out, bytes );
+	__atomic_store_n( &o->seq, o->seq + 1, __ATOMIC_RELEASE );
+
+	while( __atomic_load_n( &i->seq, __ATOMIC_ACQUIRE ) == i->ack )
+		Poll( &polls );
+	memcpy( in, i->data, bytes );
+	__atomic_store_n( &i->ack, i->ack + 1, __ATOMIC_RELEASE );
+}
+
+static void
+ShmClose( Transport *t )
+{
+	Shm *s = (Shm *) t->impl;
+	munmap( s->map, s->length );
+	free( s );
+}
+
+static const TransportOps SHMOPS = { ShmJoin, ShmShift, ShmClose };
+
+
+/*	socket: link l is a socket pair; rank l writes fds[2l] and rank l + 1
+	reads fds[2l + 1]. */
+static void
+SocketJoin( Transport *t, int rank )
+{
+	int *fds = (int *) t->impl;
+	int out = 2 * rank, in = 2 * ( ( rank + t->size - 1 ) % t->size ) + 1;
+
+	for( int f = 0; f < 2 * t->size; f++ )
+	{
+		if( f == out || f == in ) fcntl( fds[f], F_SETFL, fcntl( fds[f], F_GETFL ) | O_NONBLOCK );
+		else
+		{
+			close( fds[f] );
+			fds[f] = -1;
+		}
+	}
+}
+
+// Writes out and reads in at the same time, so neither side can fill its socket buffer and stall the ring
+static void
+SocketShift( Transport *t, const void *out, void *in, size_t bytes )
+{
+	int *fds = (int *) t->impl;
+	int wfd = fds[ 2 * t->rank ], rfd = fds[ 2 * ( ( t->rank + t->size - 1 ) % t->size ) + 1 ];
+	size_t sent = 0, got = 0;
+
+	while( sent < bytes || got < bytes )
+	{
+		// A negative fd is skipped, so a finished direction is not polled
+		struct pollfd p[2];
+		p[0].fd = sent < bytes ? wfd : -1;
+		p[0].events = POLLOUT;
+		p[0].revents = 0;
+		p[1].fd = got < bytes ? rfd : -1;
+		p[1].events = POLLIN;
+		p[1].revents = 0;
+		if( poll( p, 2, -1 ) < 0 && errno != EINTR ) abort( );
+
+		if( p[0].revents & ( POLLOUT | POLLERR | POLLHUP ) )
+		{
+			ssize_t w = write( wfd, (const char *) out + sent, bytes - sent );
+			if( w > 0 ) sent += w;
+			else if( w < 0 && errno != EAGAIN && errno != EINTR ) abort( );
+		}
+		if( p[1].revents & ( POLLIN | POLLERR | POLLHUP ) )
+		{
+			ssize_t r = read( rfd, (char *) in + got, bytes - got );
+			if( r > 0 ) got += r;
+			else if( r == 0 || ( errno != EAGAIN && errno != EINTR ) ) abort( );	// the previous rank died
+		}
+	}
+}
+
+static void
+SocketClose( Transport *t )
+{
+	int *fds = (int *) t->impl;
+	for( int f = 0; f < 2 * t->size; f++ )
+		if( fds[f] >= 0 ) close( fds[f] );
+	free( fds );
+}
+
+static const TransportOps SOCKETOPS = { SocketJoin, SocketShift, SocketClose };
+
+
+// Background thread: runs each posted shift
+static void *
+TransportThread( void *arg )
+{
+	Transport *t = (Transport *) arg;
+
+	pthread_mutex_lock( &t->lock );
+	for( ;; )
+	{
+		while( !t->posted && !t->done )
+			pthread_cond_wait( &t->cond, &t->lock );
+
+		if( !t->posted ) break;		// done and nothing left
+
+		pthread_mutex_unlock( &t->lock );
+		TransportShift( t, t->out, t->in, t->bytes );
+		pthread_mutex_lock( &t->lock );
+
+		t->posted = 0;
+		pthread_cond_broadcast( &t->cond );
+	}
+	pthread_mutex_unlock( &t->lock );
+
+	return NULL;
+}
+
+/*	Sets up every link of a ring of size processes of the given kind, for
+	messages up to maxBytes. Call before forking the other processes.
+	Returns NULL if the links could not be made. */
+Transport *
+TransportCreate( int kind, int size, size_t maxBytes )
+{
+	Transport *t = (Transport *) calloc( 1, sizeof(Transport) );
+	t->kind = kind;
+	t->size = size;
+	t->maxBytes = maxBytes;
+
+	if( kind == TRANSPORT_SHM )
+	{
+		Shm *s = (Shm *) calloc( 1, sizeof(Shm) );
+		s->stride = sizeof(ShmLink) + ( ( maxBytes + 63 ) & ~(size_t)63 );
+		s->length = s->stride * size;
+		s->map = (char *) mmap( NULL, s->length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+		if( s->map == MAP_FAILED )
+		{
+			free( s );
+			free( t );
+			return NULL;
+		}
+		t->ops = &SHMOPS;
+		t->impl = s;
+	}
+	else
+	{
+		int *fds = (int *) malloc( 2 * size * sizeof(int) );
+		for( int l = 0; l < size; l++ )
+		{
+			if( socketpair( AF_UNIX, SOCK_STREAM, 0, &fds[2 * l] ) != 0 )
+			{
+				while( --l >= 0 )
+				{
+					close( fds[2 * l] );
+					close( fds[2 * l + 1] );
+				}
+				free( fds );
+				free( t );
+				return NULL;
+			}
+		}
+		t->ops = &SOCKETOPS;
+		t->impl = fds;
+	}
+
+	return t;
+}
+
+// Makes this process rank of the ring and starts its background shift thread
+void
+TransportJoin( Transport *t, int rank )
+{
+	t->rank = rank;
+	t->ops->join( t, rank );
+
+	pthread_mutex_init( &t->lock, NULL );
+	pthread_cond_init( &t->cond, NULL );
+	pthread_create( &t->thread, NULL, TransportThread, t );
+}
+
+// Sends bytes of out to the next rank and receives bytes from the previous one into in
+void
+TransportShift( Transport *t, const void *out, void *in, size_t bytes )
+{
+	if( t->size == 1 ) memcpy( in, out, bytes );
+	else t->ops->shift( t, out, in, bytes );
+	t->shifts++;
+}
+
+// TransportShift on the background thread; out and in stay in use until TransportFinish
+void
+TransportStart( Transport *t, const void *out, void *in, size_t bytes )
+{
+	pthread_mutex_lock( &t->lock );
+	t->out = out;
+	t->in = in;
+	t->bytes = bytes;
+	t->posted = 1;
+	pthread_cond_broadcast( &t->cond );
+	pthread_mutex_unlock( &t->lock );
+}
+
+// Waits for the shift from TransportStart; the wait is what computing did not hide
+void
+TransportFinish( Transport *t )
+{
+	double t0 = omp_get_wtime( );
+
+	pthread_mutex_lock( &t->lock );
+	while( t->posted )
+		pthread_cond_wait( &t->cond, &t->lock );
+	pthread_mutex_unlock( &t->lock );
+
+	t->waitTime += omp_get_wtime( ) - t0;
+}
+
+// Stops the background thread and frees this process's end of the ring
+void
+TransportClose( Transport *t )
+{
+	pthread_mutex_lock( &t->lock );
+	t->done = 1;
+	pthread_cond_broadcast( &t->cond );
+	pthread_mutex_unlock( &t->lock );
+	pthread_join( t->thread, NULL );
+
+	pthread_mutex_destroy( &t->lock );
+	pthread_cond_destroy( &t->cond );
+	t->ops->close( t );
+	free( t );
+}
@@ -0,0 +1,75 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+/*	Ring transport for the multi-process N-body run (proj2 -r): every
+	process r of size sends to r + 1 and receives from r - 1, mod size.
+
+	The one operation is a shift: send out to the next process and receive
+	in from the previous one, every message at most maxBytes. Transports
+	plug in as a TransportOps table of blocking calls; TransportStart and
+	TransportFinish run a shift on a background thread so the caller can
+	compute while the message travels, whatever the transport.
+
+		shm		one mmap'd slot per link with sequence and acknowledge
+				counters; a sender waits for the previous message to be
+				taken, a receiver for the next one to arrive
+		socket	one Unix stream socket pair per link, written and read at
+				once with poll( ), so messages bigger than the socket
+				buffer cannot deadlock the ring
+
+	Both are set up by TransportCreate in one process before it forks the
+	others; each process then keeps its own end with TransportJoin. A
+	transport between machines would add an ops table that connects the
+	same ring over the network.
+*/
+
+enum { TRANSPORT_SHM, TRANSPORT_SOCKET, NUMTRANSPORTS };
+
+extern const char *TRANSPORTNAMES[NUMTRANSPORTS];
+
+typedef struct transport Transport;
+
+struct transportops
+{
+	void	(*join)( Transport *, int );		// keep rank's ends, drop the rest
+	void	(*shift)( Transport *, const void *, void *, size_t );
+	void	(*close)( Transport * );
+};
+
+typedef struct transportops TransportOps;
+
+struct transport
+{
+	const TransportOps *ops;
+	int kind;
+	int rank, size;
+	size_t maxBytes;
+	void *impl;				// the transport's own state
+
+	long shifts;			// shifts finished
+	double waitTime;		// seconds TransportFinish waited for the background shift
+
+	// Background shift
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	const void *out;
+	void *in;
+	size_t bytes;
+	int posted;				// a shift is waiting for the thread or running
+	int done;				// tells the thread to exit
+};
+
+Transport *	TransportCreate( int, int, size_t );
+void		TransportJoin( Transport *, int );
+void		TransportShift( Transport *, const void *, void *, size_t );
+void		TransportStart( Transport *, const void *, void *, size_t );
+void		TransportFinish( Transport * );
+void		TransportClose( Transport * );
+
+
+#endif		// TRANSPORT_H
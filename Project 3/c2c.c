@@ -0,0 +1,254 @@
+#ifndef _GNU_SOURCE
+	#define _GNU_SOURCE	// sched_setaffinity, CPU_SET
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <sched.h>
+#include <omp.h>
+#include "../Common/topology.h"
+
+/*	Core-to-core cache line transfer benchmark.
+
+	proj3 shows that two threads writing the same line is slow; this
+	measures how slow for every pair of CPUs. Two threads are pinned to
+	CPUs a and b and ping-pong a shared line: the round-trip time over two
+	gives the one-way latency of moving the line between their caches.
+	Then a block of LINES lines is handed back and forth to get bandwidth.
+	CPUs and their cores and sockets come from Common/topology.h.
+
+	Output (CSV): one row per ordered pair with its relation (smt: same
+	physical core, core: same socket, socket: different sockets), followed
+	by the latency matrix in ns and the bandwidth matrix in GB/s, CPUs in
+	socket and core order. A pair whose two threads could not be started
+	and pinned is reported on stderr and left out: its row is skipped and
+	its matrix entries are empty.
+*/
+
+// Ping-pong round trips per pair
+#ifndef ROUNDS
+	#define ROUNDS 100000
+#endif
+
+// Cache lines handed over per bandwidth round
+#ifndef LINES
+	#define LINES 256
+#endif
+
+// Block handovers per pair for bandwidth
+#ifndef BWROUNDS
+	#define BWROUNDS 2000
+#endif
+
+#define LINE 64
+
+/* A cache line with nothing else on it */
+struct line
+{
+	int flag;
+	int pad[ LINE/sizeof(int) - 1 ];
+} __attribute__((aligned(LINE)));
+
+/* Function Prototypes */
+const char *Relation( const Cpu *, const Cpu * );
+void PrintMatrix( const char *, const std::vector<Cpu> &, const double *, const char * );
+int Pin( int );
+void PinPair( int, int, int * );
+double Latency( int, int );
+double Bandwidth( int, int );
+
+struct line Flag;
+int Block[ LINES ][ LINE/sizeof(int) ] __attribute__((aligned(LINE)));
+
+int main( )
+{
+	cpu_set_t allowed;
+	sched_getaffinity( 0, sizeof(allowed), &allowed );
+
+	const std::vector<Cpu> &cpus = Topology::Machine( ).cpus( );
+	int ncpus = (int) cpus.size( );
+	if( ncpus < 2 )
+	{
+		fprintf( stderr, "Need at least two usable CPUs, have %d.\n", ncpus );
+		return EXIT_FAILURE;
+	}
+
+	double *lat = (double *) calloc( (size_t)ncpus * ncpus, sizeof(double) );
+	double *bw = (double *) calloc( (size_t)ncpus * ncpus, sizeof(double) );
+
+	fprintf( stdout, "CPU A,CPU B,Relation,Latency (ns),Bandwidth (GB/s)\n" );
+
+	for( int a = 0; a < ncpus; a++ )
+	{
+		for( int b = 0; b < ncpus; b++ )
+		{
+			if( a == b ) continue;
+
+			double ns = Latency( cpus[a].id, cpus[b].id );
+			double gbs = ns < 0. ? -1. : Bandwidth( cpus[a].id, cpus[b].id );
+			if( gbs < 0. )
+			{
+				fprintf( stderr, "Could not run two threads pinned to CPUs %d and %d; pair skipped\n", cpus[a].id, cpus[b].id );
+				lat[ a*ncpus + b ] = bw[ a*ncpus + b ] = NAN;
+				continue;
+			}
+			lat[ a*ncpus + b ] = ns;
+			bw[ a*ncpus + b ] = gbs;
+
+			fprintf( stdout, "%d,%d,%s,%.1lf,%.2lf\n", cpus[a].id, cpus[b].id,
+				Relation( &cpus[a], &cpus[b] ), ns, gbs );
+			fflush( stdout );
+		}
+	}
+
+	// Same numbers as matrices: row is the CPU that starts the ping or writes the block
+	PrintMatrix( "Latency (ns)", cpus, lat, "%.1lf" );
+	PrintMatrix( "Bandwidth (GB/s)", cpus, bw, "%.2lf" );
+
+	sched_setaffinity( 0, sizeof(allowed), &allowed );
+	free( lat );
+	free( bw );
+
+	return EXIT_SUCCESS;
+}
+
+//	Writes a blank line, then m as a CSV matrix headed by title and the CPU ids; NaN entries are left empty
+void PrintMatrix( const char *title, const std::vector<Cpu> &cpus, const double *m, const char *fmt )
+{
+	int ncpus = (int) cpus.size( );
+
+	fprintf( stdout, "\n%s", title );
+	for( int b = 0; b < ncpus; b++ )
+		fprintf( stdout, ",%d", cpus[b].id );
+	fprintf( stdout, "\n" );
+
+	for( int a = 0; a < ncpus; a++ )
+	{
+		fprintf( stdout, "%d", cpus[a].id );
+		for( int b = 0; b < ncpus; b++ )
+		{
+			fprintf( stdout, "," );
+			if( !isnan( m[ a*ncpus + b ] ) ) fprintf( stdout, fmt, m[ a*ncpus + b ] );
+		}
+		fprintf( stdout, "\n" );
+	}
+}
+
+//	How far apart two CPUs are
+const char *Relation( const Cpu *a, const Cpu *b )
+{
+	if( a->socket != b->socket ) return "socket";
+	if( a->core == b->core ) return "smt";
+	return "core";
+}
+
+//	Pins the calling thread to one CPU. Returns 0 on success.
+int Pin( int id )
+{
+	cpu_set_t set;
+	CPU_ZERO( &set );
+	CPU_SET( id, &set );
+	return sched_setaffinity( 0, sizeof(set), &set );
+}
+
+/*	Pins the calling thread of a two-thread team to a (thread 0) or b,
+	setting *failed if the team is short or the pin fails. The team then
+	reads *failed after a barrier, so both threads skip the pair together
+	rather than one spinning for a partner that is not there. */
+void PinPair( int a, int b, int *failed )
+{
+	if( omp_get_num_threads( ) != 2 || Pin( omp_get_thread_num( ) == 0 ? a : b ) != 0 )
+		__atomic_store_n( failed, 1, __ATOMIC_RELAXED );
+}
+
+/*	One-way latency in ns of moving Flag's line between CPUs a and b.
+	a writes odd values and waits for b to answer with the next even one.
+	Negative if the pair could not be pinned. */
+double Latency( int a, int b )
+{
+	double tElapsed = 0.;
+	int failed = 0;
+
+	Flag.flag = 0;
+
+	#pragma omp parallel num_threads(2)
+	{
+		int me = omp_get_thread_num( );
+		PinPair( a, b, &failed );
+		#pragma omp barrier
+		int skip = __atomic_load_n( &failed, __ATOMIC_RELAXED );
+
+		if( !skip && me == 0 )
+		{
+			double tStart = omp_get_wtime( );
+			for( int r = 0; r < ROUNDS; r++ )
+			{
+				__atomic_store_n( &Flag.flag, 2*r + 1, __ATOMIC_RELEASE );
+				while( __atomic_load_n( &Flag.flag, __ATOMIC_ACQUIRE ) != 2*r + 2 );
+			}
+			tElapsed = omp_get_wtime( ) - tStart;
+		}
+		else if( !skip )
+		{
+			for( int r = 0; r < ROUNDS; r++ )
+			{
+				while( __atomic_load_n( &Flag.flag, __ATOMIC_ACQUIRE ) != 2*r + 1 );
+				__atomic_store_n( &Flag.flag, 2*r + 2, __ATOMIC_RELEASE );
+			}
+		}
+	}
+
+	return failed ? -1. : tElapsed / ROUNDS / 2. * 1.e9;
+}
+
+/*	GB/s moved from a to b: a dirties LINES lines, b reads them all and
+	hands the block back, BWROUNDS times. Includes the handover latency,
+	as a real producer/consumer pair would see it. Negative if the pair
+	could not be pinned. */
+double Bandwidth( int a, int b )
+{
+	double tElapsed = 0.;
+	int failed = 0;
+
+	Flag.flag = 0;
+
+	#pragma omp parallel num_threads(2)
+	{
+		int me = omp_get_thread_num( );
+		PinPair( a, b, &failed );
+		#pragma omp barrier
+		int skip = __atomic_load_n( &failed, __ATOMIC_RELAXED );
+
+		if( !skip && me == 0 )
+		{
+			double tStart = omp_get_wtime( );
+			for( int r = 0; r < BWROUNDS; r++ )
+			{
+				for( int i = 0; i < LINES; i++ )
+					for( int w = 0; w < LINE/(int)sizeof(int); w++ )
+						Block[i][w] = r;
+
+				__atomic_store_n( &Flag.flag, 2*r + 1, __ATOMIC_RELEASE );
+				while( __atomic_load_n( &Flag.flag, __ATOMIC_ACQUIRE ) != 2*r + 2 );
+			}
+			tElapsed = omp_get_wtime( ) - tStart;
+		}
+		else if( !skip )
+		{
+			int sum = 0;
+			for( int r = 0; r < BWROUNDS; r++ )
+			{
+				while( __atomic_load_n( &Flag.flag, __ATOMIC_ACQUIRE ) != 2*r + 1 );
+
+				for( int i = 0; i < LINES; i++ )
+					for( int w = 0; w < LINE/(int)sizeof(int); w++ )
+						sum += Block[i][w];
+
+				__atomic_store_n( &Flag.flag, 2*r + 2, __ATOMIC_RELEASE );
+			}
+			Block[0][0] = sum;	// keep the reads
+		}
+	}
+
+	return failed ? -1. : (double)BWROUNDS * LINES * LINE / tElapsed / 1.e9;
+}
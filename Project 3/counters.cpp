@@ -0,0 +1,194 @@
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <omp.h>
+#include "../Common/shard.h"
+
+/*	Per-thread counter strategies head to head.
+
+	Every thread adds 1 OPS times to a shared total. Every WRITES-th add it
+	also reads the total, so the write-to-read ratio can be swept. Strategies:
+
+	falseshare	each thread's counter packed next to the others' (proj3 oneFix)
+	local		stack temporary, folded in at the end (proj3 twoFix)
+	sharded		Sharded<long>: one padded line per thread, read sums all lines
+	stdatomic	one std::atomic<long>, fetch_add
+	ompatomic	one long, #pragma omp atomic
+	reduction	#pragma omp parallel for reduction(+:)
+
+	local and reduction have no total until the region ends, so they only
+	run with no reads (WRITES per read of 0).
+
+	Output (CSV): Strategy,Threads,Writes per Read,Mops/sec,Correct
+*/
+
+// Adds per thread
+#ifndef OPS
+	#define OPS 20000000
+#endif
+
+// Highest thread count to sweep to; 0 for omp_get_num_procs
+#ifndef MAXTHREADS
+	#define MAXTHREADS 0
+#endif
+
+enum Strategy { FALSESHARE, LOCAL, SHARDED, STDATOMIC, OMPATOMIC, REDUCTION, NSTRATEGIES };
+
+const char *NAMES[] = { "falseshare", "local", "sharded", "stdatomic", "ompatomic", "reduction" };
+
+// Keeps the compiler from folding a loop of adds into one
+#define KEEP( x )	asm volatile( "" : "+r"( x ) )
+
+// Reads seen by one thread; summed and printed so reads are not dead code
+long Sink = 0;
+
+/*	Runs one strategy with threads threads, reading the total every
+	writes adds (never if writes is 0). Returns Mops/sec and sets ok
+	if the final total is right. */
+template <int S>
+double Run( int threads, long writes, bool *ok )
+{
+	const long total = (long)threads * OPS;
+	long result = 0;
+	long sink = 0;
+
+	std::atomic<long> *packed = new std::atomic<long>[ threads ];
+	Sharded<long> sharded( threads );
+	std::atomic<long> shared( 0 );
+	long plain = 0;
+
+	for( int t = 0; t < threads; t++ )
+		packed[t].store( 0 );
+
+	double tStart = omp_get_wtime( );
+
+	if( S == REDUCTION )
+	{
+		#pragma omp parallel for num_threads(threads) reduction(+:result) schedule(static)
+		for( long i = 0; i < total; i++ )
+		{
+			long one = 1;
+			KEEP( one );
+			result += one;
+		}
+	}
+	else
+	{
+		#pragma omp parallel num_threads(threads) reduction(+:sink)
+		{
+			int me = omp_get_thread_num( );
+			long mine = 0;
+			long until = writes;
+
+			for( long i = 0; i < OPS; i++ )
+			{
+				switch( S )
+				{
+					case FALSESHARE:
+						packed[me].store( packed[me].load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+						break;
+					case LOCAL:
+						mine++;
+						KEEP( mine );
+						break;
+					case SHARDED:
+						sharded.add( me, 1 );
+						break;
+					case STDATOMIC:
+						shared.fetch_add( 1, std::memory_order_relaxed );
+						break;
+					case OMPATOMIC:
+						#pragma omp atomic
+						plain++;
+						break;
+				}
+
+				if( writes > 0 && --until == 0 )
+				{
+					until = writes;
+					switch( S )
+					{
+						case FALSESHARE:
+							for( int t = 0; t < threads; t++ )
+								sink += packed[t].load( std::memory_order_relaxed );
+							break;
+						case SHARDED:
+							sink += sharded.read( );
+							break;
+						case STDATOMIC:
+							sink += shared.load( std::memory_order_relaxed );
+							break;
+						case OMPATOMIC:
+						{
+							long v;
+							#pragma omp atomic read
+							v = plain;
+							sink += v;
+							break;
+						}
+					}
+				}
+			}
+
+			if( S == LOCAL )
+			{
+				#pragma omp atomic
+				result += mine;
+			}
+		}
+	}
+
+	double tEnd = omp_get_wtime( );
+
+	switch( S )
+	{
+		case FALSESHARE:
+			for( int t = 0; t < threads; t++ )
+				result += packed[t].load( );
+			break;
+		case SHARDED:	result = sharded.read( );	break;
+		case STDATOMIC:	result = shared.load( );	break;
+		case OMPATOMIC:	result = plain;				break;
+	}
+
+	delete [] packed;
+	Sink += sink;
+
+	*ok = ( result == total );
+
+	long reads = writes > 0 ? total / writes : 0;
+	return (double)( total + reads ) / ( tEnd - tStart ) / 1000000.;
+}
+
+typedef double (*RunFn)( int, long, bool * );
+
+int main( )
+{
+	RunFn runs[ NSTRATEGIES ] = { Run<FALSESHARE>, Run<LOCAL>, Run<SHARDED>, Run<STDATOMIC>, Run<OMPATOMIC>, Run<REDUCTION> };
+	const long ratios[] = { 0, 1000, 100, 10, 1 };
+
+	int maxThreads = MAXTHREADS > 0 ? MAXTHREADS : omp_get_num_procs( );
+
+	fprintf( stdout, "Strategy,Threads,Writes per Read,Mops/sec,Correct\n" );
+
+	for( int threads = 1; threads <= maxThreads; threads++ )
+	{
+		for( long writes : ratios )
+		{
+			for( int s = 0; s < NSTRATEGIES; s++ )
+			{
+				// No mid-run total to read
+				if( writes > 0 && ( s == LOCAL || s == REDUCTION ) ) continue;
+
+				bool ok;
+				double mops = runs[s]( threads, writes, &ok );
+				fprintf( stdout, "%s,%d,%ld,%lf,%s\n", NAMES[s], threads, writes, mops, ok ? "yes" : "no" );
+				fflush( stdout );
+			}
+		}
+	}
+
+	fprintf( stderr, "(read checksum %ld)\n", Sink );
+
+	return EXIT_SUCCESS;
+}
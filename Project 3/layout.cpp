@@ -0,0 +1,266 @@
+#include <cstdlib>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+#include <vector>
+#include <omp.h>
+#include "../Common/config.h"
+
+/*	Single-binary layout sweep for the proj3 false sharing experiment.
+
+	script3 compiles proj3 once per (FIX, THREAD_COUNT, PAD_COUNT). Here the
+	padded struct s is a template, so every PAD_COUNT from 0 to MAXPAD is
+	compiled into one binary, and thread count and the base address offset
+	within a cache line are swept at runtime.
+
+	Run as: layout [threads=N|threads=a,b,...] [config=file]
+	threads=N sweeps 1 to N threads, a list runs just those counts.
+	Layouts:
+
+	aos		struct s { float value; int pad[PAD]; } array, as in proj3
+	soa		the values split off into their own float array (what an AoS to
+			SoA conversion does to per-thread fields)
+	soa-line	the same array with each value on its own line
+
+	Every run is oneFix's in-place update. The baseline is the same update
+	with each value on its own line (soa-line), which cannot false share.
+	twoFix's stack temporary is also reported, but it is not the baseline:
+	CPUs that rename stack memory make it faster even with one thread.
+	Output (CSV):
+
+	Layout,Pad,Offset,Threads,MCalcs/sec,Shared Lines,% of Baseline
+
+	Shared Lines is how many cache lines more than one thread writes to,
+	worked out from the addresses, so the measured cliff can be checked
+	against the prediction. A summary after the table gives, per offset and
+	thread count, the smallest pad that reaches 90% of the baseline.
+*/
+
+#ifndef BIG
+	#define BIG 10000000
+#endif
+
+#ifndef ELEMENTS
+	#define ELEMENTS 4
+#endif
+
+#ifndef MAXPAD
+	#define MAXPAD 16
+#endif
+
+// Default sweep: 1 to MAXTHREADS threads
+#ifndef MAXTHREADS
+	#define MAXTHREADS 4
+#endif
+
+#define LINE 64
+
+/* proj3's struct s with PAD padding ints */
+template <int PAD>
+struct S
+{
+	float value;
+	int pad[ PAD ];
+};
+
+template <>
+struct S<0>
+{
+	float value;
+};
+
+/* A value alone on its cache line, for the padded SoA array */
+struct alignas( LINE ) LineFloat
+{
+	float value;
+};
+
+// Thread counts swept, from threads=
+std::vector<int> Threads;
+
+/* Summary, by offset and index into Threads: smallest pad at or above 90% of baseline */
+std::vector< std::vector<int> > FirstClean;
+
+// soa-line MCalcs/sec at each of Threads
+std::vector<double> Baseline;
+
+/*	oneFix over ELEMENTS values, the i-th at base + i*stride. volatile
+	keeps every add a load and store to memory, like proj3's -O0 build. */
+double InPlace( char *base, size_t stride, int threads )
+{
+	double tStart = omp_get_wtime( );
+
+	#pragma omp parallel for num_threads(threads) schedule(static)
+	for( int i = 0; i < ELEMENTS; i++ )
+	{
+		volatile float *v = (volatile float *)( base + i*stride );
+		for( int j = 0; j < BIG; j++ )
+		{
+			*v = *v + 2.;
+		}
+	}
+
+	double tEnd = omp_get_wtime( );
+	return (double)ELEMENTS * BIG / ( tEnd - tStart ) / 1000000.;	// MCalcs/sec
+}
+
+//	twoFix: a stack temporary per element, written back once
+double Private( float *values, int threads )
+{
+	double tStart = omp_get_wtime( );
+
+	#pragma omp parallel for num_threads(threads) schedule(static)
+	for( int i = 0; i < ELEMENTS; i++ )
+	{
+		volatile float tmp = values[i];
+		for( int j = 0; j < BIG; j++ )
+		{
+			tmp = tmp + 2.;
+		}
+		values[i] = tmp;
+	}
+
+	double tEnd = omp_get_wtime( );
+	return (double)ELEMENTS * BIG / ( tEnd - tStart ) / 1000000.;
+}
+
+/*	Cache lines written by more than one thread, for values at base +
+	i*stride handed out by schedule(static) to threads threads. */
+int SharedLines( char *base, size_t stride, int threads )
+{
+	// Ask the runtime who gets which element rather than assume its split
+	int owner[ ELEMENTS ];
+	#pragma omp parallel for num_threads(threads) schedule(static)
+	for( int i = 0; i < ELEMENTS; i++ )
+		owner[i] = omp_get_thread_num( );
+
+	int shared = 0;
+	for( int i = 0; i < ELEMENTS; i++ )
+	{
+		uintptr_t line = (uintptr_t)( base + i*stride ) / LINE;
+		bool first = true, others = false;
+
+		for( int j = 0; j < ELEMENTS; j++ )
+		{
+			if( (uintptr_t)( base + j*stride ) / LINE != line ) continue;
+			if( j < i ) first = false;				// line already counted
+			if( owner[j] != owner[i] ) others = true;
+		}
+
+		if( first && others ) shared++;
+	}
+
+	return shared;
+}
+
+// One CSV line for the k-th thread count
+void Report( const char *layout, int pad, int offset, int k, double mcalcs, int shared )
+{
+	double pct = 100. * mcalcs / Baseline[k];
+	fprintf( stdout, "%s,%d,%d,%d,%lf,%d,%.1lf\n", layout, pad, offset, Threads[k], mcalcs, shared, pct );
+	fflush( stdout );
+}
+
+//	Every offset and thread count for one struct s padding
+template <int PAD>
+void SweepPad( char *buffer )
+{
+	for( int offset = 0; offset < LINE; offset += sizeof(float) )
+	{
+		char *base = buffer + offset;
+		for( size_t k = 0; k < Threads.size( ); k++ )
+		{
+			double mcalcs = InPlace( base, sizeof(S<PAD>), Threads[k] );
+			Report( "aos", PAD, offset, k, mcalcs, SharedLines( base, sizeof(S<PAD>), Threads[k] ) );
+
+			int &first = FirstClean[ offset/sizeof(float) ][k];
+			if( first < 0 && mcalcs >= 0.9 * Baseline[k] ) first = PAD;
+		}
+	}
+}
+
+template <int... PADS>
+void SweepAll( char *buffer, std::integer_sequence<int, PADS...> )
+{
+	( SweepPad<PADS>( buffer ), ... );
+}
+
+int main( int argc, char **argv )
+{
+	Config cfg( argc, argv );
+	const char *list = cfg.get( "threads", "" );
+	if( !cfg.check( stderr ) ) return EXIT_FAILURE;
+
+	// A count sweeps 1 to it; a comma list is taken as is
+	int max = list[0] != '\0' ? atoi( list ) : MAXTHREADS;
+	if( strchr( list, ',' ) != NULL )
+	{
+		for( const char *p = list; p != NULL; p = strchr( p, ',' ) )
+		{
+			if( *p == ',' ) p++;
+			Threads.push_back( atoi( p ) );
+		}
+	}
+	else for( int t = 1; t <= max; t++ )
+		Threads.push_back( t );
+
+	bool bad = Threads.empty( );
+	for( size_t k = 0; k < Threads.size( ); k++ )
+		if( Threads[k] < 1 ) bad = true;
+	if( bad )
+	{
+		fprintf( stderr, "Bad thread count in threads=%s\n", list );
+		return EXIT_FAILURE;
+	}
+
+	// Room for the largest struct array plus a full line of offset
+	size_t bytes = ( sizeof(S<MAXPAD>) * ELEMENTS + LINE + sizeof(LineFloat) * ELEMENTS + LINE - 1 ) & ~(size_t)( LINE - 1 );
+	char *buffer = (char *) aligned_alloc( LINE, bytes );
+
+	// Defined values for the kernels to update, and its page faulted in before the first timed pass
+	memset( buffer, 0, bytes );
+
+	FirstClean.assign( LINE/4, std::vector<int>( Threads.size( ), -1 ) );
+
+	for( size_t k = 0; k < Threads.size( ); k++ )
+		Baseline.push_back( InPlace( buffer, sizeof(LineFloat), Threads[k] ) );
+
+	fprintf( stdout, "Layout,Pad,Offset,Threads,MCalcs/sec,Shared Lines,%% of Baseline\n" );
+
+	for( size_t k = 0; k < Threads.size( ); k++ )
+	{
+		Report( "soa-line", 0, 0, k, Baseline[k], SharedLines( buffer, sizeof(LineFloat), Threads[k] ) );
+		Report( "private", 0, 0, k, Private( (float *) buffer, Threads[k] ), 0 );
+	}
+
+	SweepAll( buffer, std::make_integer_sequence<int, MAXPAD + 1>{ } );
+
+	// SoA: packed values share lines whatever the struct looked like; one per line never do
+	for( int offset = 0; offset < LINE; offset += sizeof(float) )
+	{
+		for( size_t k = 0; k < Threads.size( ); k++ )
+		{
+			char *base = buffer + offset;
+			Report( "soa", 0, offset, k, InPlace( base, sizeof(float), Threads[k] ), SharedLines( base, sizeof(float), Threads[k] ) );
+		}
+	}
+
+	// Where each offset stops suffering: smallest aos pad within 10% of the baseline
+	fprintf( stdout, "\nOffset" );
+	for( size_t k = 0; k < Threads.size( ); k++ )
+		fprintf( stdout, ",Clean Pad (%d threads)", Threads[k] );
+	fprintf( stdout, "\n" );
+
+	for( int offset = 0; offset < LINE; offset += sizeof(float) )
+	{
+		fprintf( stdout, "%d", offset );
+		for( size_t k = 0; k < Threads.size( ); k++ )
+			fprintf( stdout, ",%d", FirstClean[ offset/sizeof(float) ][k] );
+		fprintf( stdout, "\n" );
+	}
+
+	free( buffer );
+
+	return EXIT_SUCCESS;
+}
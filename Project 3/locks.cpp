@@ -0,0 +1,300 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <mutex>
+#include <omp.h>
+#include "../Common/config.h"
+#include "../Common/topology.h"
+#include "../Common/locks.h"
+
+/*	Locks under contention, the lock-based counterpart of proj3's false
+	sharing.
+
+	Every thread loops acquiring one shared lock, doing cs units of work
+	on shared data inside (one increment of one of CSWORDS words each),
+	releasing it and doing think units of private work outside, until ms
+	milliseconds are up. Locks (Common/locks.h for the spin locks):
+
+	tas		test-and-set					ticket	ticket lock
+	ttas	test-and-test-and-set, backoff	mcs		MCS queue lock
+	mutex	std::mutex						omp		omp_lock_t
+
+	Run as: locks [lock=name|all] [threads=N] [cs=N] [think=N] [ms=N] [place=policy] [config=file]
+	Sweeps 1 to threads threads for each lock, each team pinned by place
+	(Common/topology.h).
+
+	Output (CSV): Lock,Threads,CS,Think,Place,Macq/sec,Fairness,Min Share,
+		Max Share,p50 ns,p99 ns,p99.9 ns,Max ns,Correct
+	Fairness is Jain's index of the acquisitions per thread, 1 when every
+	thread got the same number and 1/threads when one got them all; the
+	shares are the least and most any thread got over the mean. The
+	percentiles are of the time from calling lock( ) to holding the lock,
+	to within an eighth, from a histogram per thread. Correct is whether
+	the shared data saw every increment, i.e. the lock excluded.
+*/
+
+// Highest thread count to sweep to; 0 for omp_get_num_procs
+#ifndef MAXTHREADS
+	#define MAXTHREADS 0
+#endif
+
+// Work inside the lock, in shared increments
+#ifndef CSWORK
+	#define CSWORK 20
+#endif
+
+// Work between acquisitions, in private steps
+#ifndef THINK
+	#define THINK 100
+#endif
+
+// Length of each run
+#ifndef MS
+	#define MS 200
+#endif
+
+// Shared words the critical section works on, a power of 2
+#define CSWORDS 16
+
+// Histogram buckets per power of 2 of latency, a power of 2
+#define SUBBUCKETS 8
+#define BUCKETS ( 64 * SUBBUCKETS )
+
+enum Kind { TAS, TTAS, TICKET, MCS, MUTEX, OMP, NKINDS };
+
+const char *NAMES[] = { "tas", "ttas", "ticket", "mcs", "mutex", "omp", "all" };
+
+// Keeps the compiler from folding a loop into one step
+#define KEEP( x )	asm volatile( "" : "+r"( x ) )
+
+/* Data the lock protects, off the lock's line */
+struct alignas( LOCK_LINE ) Protected
+{
+	long words[CSWORDS];
+	long count;			// acquisitions
+};
+
+/* omp_lock_t as a lockable */
+class OmpLock
+{
+	public:
+		OmpLock( ) { omp_init_lock( &l ); }
+		~OmpLock( ) { omp_destroy_lock( &l ); }
+
+		void lock( ) { omp_set_lock( &l ); }
+		void unlock( ) { omp_unset_lock( &l ); }
+
+	private:
+		omp_lock_t l;
+};
+
+/* Every lock behind the per-thread node interface of MCS */
+template <typename L>
+struct Plain
+{
+	struct Node { };
+	L l;
+	void lock( Node & ) { l.lock( ); }
+	void unlock( Node & ) { l.unlock( ); }
+};
+
+struct Mcs
+{
+	typedef McsLock::Node Node;
+	McsLock l;
+	void lock( Node &n ) { l.lock( n ); }
+	void unlock( Node &n ) { l.unlock( n ); }
+};
+
+/* Log-linear histogram of latencies in ns */
+struct alignas( LOCK_LINE ) Histogram
+{
+	long counts[BUCKETS];
+	long max;
+
+	static int Bucket( long ns )
+	{
+		if( ns < SUBBUCKETS ) return (int) ns;
+		int e = 63 - __builtin_clzl( ns );		// ns >= 2^e, e >= log2( SUBBUCKETS )
+		int shift = e - __builtin_ctz( SUBBUCKETS );
+		return ( shift + 1 ) * SUBBUCKETS + (int)( ( ns >> shift ) & ( SUBBUCKETS - 1 ) );
+	}
+
+	// Least ns in bucket b
+	static long Low( int b )
+	{
+		if( b < SUBBUCKETS ) return b;
+		int shift = b / SUBBUCKETS - 1;
+		return (long)( SUBBUCKETS + b % SUBBUCKETS ) << shift;
+	}
+
+	void add( long ns )
+	{
+		counts[ Bucket( ns ) ]++;
+		if( ns > max ) max = ns;
+	}
+};
+
+/* What a run measured */
+struct Result
+{
+	double macq;			// million acquisitions per second
+	double fairness, minShare, maxShare;
+	long p50, p99, p999, max;
+	bool ok;
+};
+
+static inline long Now( )
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now( ).time_since_epoch( ) ).count( );
+}
+
+// Least ns of the bucket the q-th fraction of the merged histogram falls in
+static long Percentile( const Histogram &h, long total, double q )
+{
+	long want = (long) ceil( q * total ), seen = 0;
+	for( int b = 0; b < BUCKETS; b++ )
+	{
+		seen += h.counts[b];
+		if( seen >= want && seen > 0 ) return Histogram::Low( b );
+	}
+	return h.max;
+}
+
+/*	Runs lock kind L with threads threads, cs increments inside and
+	think steps outside, for ms milliseconds */
+template <typename L>
+Result Run( int threads, int cs, int think, int ms )
+{
+	L *lock = new L;
+	Protected *data = new Protected;
+	memset( data->words, 0, sizeof(data->words) );
+	data->count = 0;
+
+	Histogram *hist = new Histogram[ threads ];
+	memset( (void *) hist, 0, threads * sizeof(Histogram) );
+	long *acquired = new long[ threads ];
+	long start = 0, end = 0;
+
+	#pragma omp parallel num_threads(threads) reduction(max:end)
+	{
+		int me = omp_get_thread_num( );
+		typename L::Node node;
+		Histogram &h = hist[me];
+		long n = 0;
+		unsigned long x = me + 1;
+
+		#pragma omp single
+		start = Now( );
+
+		long deadline = start + ms * 1000000L;
+		for( ;; )
+		{
+			long t0 = Now( );
+			lock->lock( node );
+			long t1 = Now( );
+
+			for( int i = 0; i < cs; i++ )
+			{
+				data->words[ i & ( CSWORDS - 1 ) ]++;
+				asm volatile( "" ::: "memory" );
+			}
+			data->count++;
+
+			lock->unlock( node );
+
+			h.add( t1 - t0 );
+			n++;
+
+			for( int i = 0; i < think; i++ )
+			{
+				x = x * 6364136223846793005ul + 1442695040888963407ul;
+				KEEP( x );
+			}
+
+			if( t1 >= deadline ) break;
+		}
+
+		acquired[me] = n;
+		end = Now( );
+	}
+
+	Result r;
+	long total = 0, most = 0, least = acquired[0];
+	double squares = 0.;
+	Histogram all;
+	memset( (void *) &all, 0, sizeof(all) );
+	for( int t = 0; t < threads; t++ )
+	{
+		total += acquired[t];
+		squares += (double) acquired[t] * acquired[t];
+		if( acquired[t] > most ) most = acquired[t];
+		if( acquired[t] < least ) least = acquired[t];
+		for( int b = 0; b < BUCKETS; b++ )
+			all.counts[b] += hist[t].counts[b];
+		if( hist[t].max > all.max ) all.max = hist[t].max;
+	}
+
+	long words = 0;
+	for( int w = 0; w < CSWORDS; w++ )
+		words += data->words[w];
+
+	double mean = (double) total / threads;
+	r.macq = total / ( ( end - start ) / 1e9 ) / 1000000.;
+	r.fairness = (double) total * total / ( threads * squares );
+	r.minShare = least / mean;
+	r.maxShare = most / mean;
+	r.p50 = Percentile( all, total, 0.5 );
+	r.p99 = Percentile( all, total, 0.99 );
+	r.p999 = Percentile( all, total, 0.999 );
+	r.max = all.max;
+	r.ok = data->count == total && words == total * cs;
+
+	delete lock;
+	delete data;
+	delete [] hist;
+	delete [] acquired;
+	return r;
+}
+
+typedef Result (*RunFn)( int, int, int, int );
+
+int main( int argc, char **argv )
+{
+	RunFn runs[ NKINDS ] = { Run< Plain<TasLock> >, Run< Plain<TtasLock> >, Run< Plain<TicketLock> >, Run<Mcs>,
+		Run< Plain<std::mutex> >, Run< Plain<OmpLock> > };
+
+	Config cfg( argc, argv );
+	int only = cfg.choice( "lock", NAMES, NKINDS + 1, NKINDS );
+	int maxThreads = cfg.get( "threads", MAXTHREADS );
+	int cs = cfg.get( "cs", CSWORK );
+	int think = cfg.get( "think", THINK );
+	int ms = cfg.get( "ms", MS );
+	int place = cfg.choice( "place", PLACENAMES, NUMPLACES, PLACE_NONE );
+	if( !cfg.check( stderr ) ) return EXIT_FAILURE;
+
+	if( maxThreads <= 0 ) maxThreads = omp_get_num_procs( );
+
+	fprintf( stdout, "Lock,Threads,CS,Think,Place,Macq/sec,Fairness,Min Share,Max Share,p50 ns,p99 ns,p99.9 ns,Max ns,Correct\n" );
+
+	for( int k = 0; k < NKINDS; k++ )
+	{
+		if( only != NKINDS && only != k ) continue;
+
+		for( int threads = 1; threads <= maxThreads; threads++ )
+		{
+			omp_set_num_threads( threads );
+			Topology::Place( place, threads );
+
+			Result r = runs[k]( threads, cs, think, ms );
+			fprintf( stdout, "%s,%d,%d,%d,%s,%lf,%lf,%lf,%lf,%ld,%ld,%ld,%ld,%s\n", NAMES[k], threads, cs, think, PLACENAMES[place],
+				r.macq, r.fairness, r.minShare, r.maxShare, r.p50, r.p99, r.p999, r.max, r.ok ? "yes" : "no" );
+			fflush( stdout );
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -1,7 +1,17 @@
 #include <stdlib.h>
 #include <limits.h>
 #include <stdio.h>
+#include <utility>
 #include <omp.h>
+#include "../Common/bench.h"
+#include "../Common/config.h"
+#include "../Common/topology.h"
+
+/*	Run as: proj3 [fix=0|1] [threads=N] [pad=N] [big=N] [tries=N] [warmup=N] [place=policy] [config=file]
+	The -D values below are the defaults. Every pad from 0 to MAXPAD is
+	compiled in as its own kernel, so one build sweeps them all. place
+	pins the threads: none, compact (false sharing within a core), scatter,
+	core or socket (Common/topology.h). */
 
 #ifndef BIG
 	#define BIG 1000000000
@@ -24,63 +34,122 @@
 	#define PAD_COUNT 0
 #endif
 
+// Largest pad with a kernel
+#ifndef MAXPAD
+	#define MAXPAD 16
+#endif
+
+// Timed runs, after WARMUP untimed ones
+#ifndef TRIES
+	#define TRIES 5
+#endif
+
+#ifndef WARMUP
+	#define WARMUP 1
+#endif
+
 /* A struct of arbitrary values and some padding ints */
+template <int PAD>
 struct s
 {
 	float value;
-	int pad[ PAD_COUNT ];
+	int pad[ PAD ];
 };
 
+// One kernel: runs the calculations on an array of struct s<PAD>
+typedef void (*Kernel)( void *, long );
+
 /* Function Prototypes */
-float oneFix( struct s * );
-float twoFix( struct s * );
+template <int PAD> void oneFix( void *, long );
+template <int PAD> void twoFix( void *, long );
+
+// Kernels[fix][pad] for every pad up to MAXPAD
+template <int... PADS>
+struct KernelTable
+{
+	Kernel fixes[2][ sizeof...(PADS) ];
+	size_t sizes[ sizeof...(PADS) ];
+
+	constexpr KernelTable( std::integer_sequence<int, PADS...> )
+		: fixes{ { &oneFix<PADS>... }, { &twoFix<PADS>... } }, sizes{ sizeof(s<PADS>)... } { }
+};
+
+template <int... PADS>
+constexpr KernelTable<PADS...> MakeTable( std::integer_sequence<int, PADS...> seq )
+{
+	return KernelTable<PADS...>( seq );
+}
+
+static const auto Kernels = MakeTable( std::make_integer_sequence<int, MAXPAD + 1>{ } );
 
 int main(int argc, char *argv[])
 {
+	Config cfg( argc, argv );
+	int fix = cfg.get( "fix", FIX ) != 0;
+	int threads = cfg.get( "threads", THREAD_COUNT );
+	int pad = cfg.get( "pad", PAD_COUNT );
+	long big = cfg.get( "big", (long) BIG );
+	int tries = cfg.get( "tries", TRIES );
+	int warmup = cfg.get( "warmup", WARMUP );
+	int place = cfg.choice( "place", PLACENAMES, NUMPLACES, PLACE_NONE );
+	if( !cfg.check( stderr ) ) return EXIT_FAILURE;
+
+	if( pad < 0 || pad > MAXPAD )
+	{
+		fprintf( stderr, "pad must be 0 to %d; rebuild with a larger MAXPAD\n", MAXPAD );
+		return EXIT_FAILURE;
+	}
+
 	// Allocate array with an address at an address that is a multiple of 64
-	struct s *array = aligned_alloc( (size_t)64, ( sizeof(struct s) * ELEMENTS ) );
+	void *array = aligned_alloc( (size_t)64, ( Kernels.sizes[ pad ] * ELEMENTS + 63 ) & ~(size_t)63 );
+
+	Kernel pFun = Kernels.fixes[ fix ][ pad ];	// function pointer, now for a reason
+
+	omp_set_num_threads( threads );
+	Topology::Place( place, threads );
 
-	float (*pFun)( struct s *);	// function pointer because why not?
+	Bench bench( "proj3", (double)ELEMENTS * big, warmup, tries );
+	bench.config( "fix=%d threads=%d pad=%d", fix, threads, pad );
+	bench.count( threads );
+	const BenchStats &stats = bench.run( [=]( ) { pFun( array, big ); } );
+	bench.report( );
 
-	// Set function pointer
-	if ( FIX ) pFun = &twoFix;
-	else pFun = &oneFix;
+	// Print diagnostic as CSV: median MegaCalculations per second, then any counters
+	fprintf( stdout, "%d,%d,%d,%lf", fix, threads, pad, bench.mrate( stats.median ) );
+	bench.counterColumns( stdout );
+	fprintf( stdout, "\n" );
 
-	// Print diagnostic as CSV.
-	fprintf( stdout, "%d,%d,%d,%lf\n", FIX, THREAD_COUNT, PAD_COUNT, pFun( array ));
+	// False sharing shows up per thread, so break the counts down on stderr
+	if( bench.counters( ) != NULL ) bench.counters( )->print( stderr, "proj3" );
 
 	free( array );
 
 	return EXIT_SUCCESS;	// Way to go, (thread) team!
 }
 
-//	Performs calculations and reports MegaCalculations per second 
-float oneFix( struct s *array )
+//	Performs ELEMENTS * big calculations in place
+template <int PAD>
+void oneFix( void *data, long big )
 {	
-	omp_set_num_threads( THREAD_COUNT );
-	double tStart = omp_get_wtime();
+	struct s<PAD> *array = (struct s<PAD> *) data;
 
 	#pragma omp parallel for
 	for( int i = 0; i < ELEMENTS; i++ )
 	{
-		for( int j = 0; j < BIG; j++ )
+		for( long j = 0; j < big; j++ )
 		{
 			// False sharing ahoy!
 			array[ i ].value = array[ i ].value + 2.;
 		}
 	}
-
-	double tEnd = omp_get_wtime();
-
-	return 4000. / ( tEnd - tStart );	// MCalcs/sec
 }
 
-/*	Performs calculations and reports MegaCalculations per second
+/*	Performs ELEMENTS * big calculations
 	Uses a private variable on each thread's stack. */
-float twoFix( struct s *array )
+template <int PAD>
+void twoFix( void *data, long big )
 {
-	omp_set_num_threads( THREAD_COUNT );
-	double tStart = omp_get_wtime( );
+	struct s<PAD> *array = (struct s<PAD> *) data;
 
 	#pragma omp parallel for
 	for( int i = 0; i < ELEMENTS; i++ )
@@ -88,14 +157,11 @@ float twoFix( struct s *array )
 		// Private variable goes on each thread's own stack.
 		float tmp = array[ i ].value;
 
-		for( int j = 0; j < BIG; j++ )
+		for( long j = 0; j < big; j++ )
 		{
 			tmp = tmp + 2.;
 		}
 
 		array[ i ].value = tmp;	// Record result.
 	}
-
-	double tEnd = omp_get_wtime();
-	return 4000. / ( tEnd - tStart );	// MCalcs/sec
 }
@@ -0,0 +1,160 @@
+#ifndef _GNU_SOURCE
+	#define _GNU_SOURCE	// syscall, sched_yield
+#endif
+#include "barrier.h"
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <omp.h>
+
+
+const char *BARRIERNAMES[NUMBARRIERS] = { "omp", "sense", "dissem", "futex" };
+
+// One poll of a spin loop: pause, and give up the CPU now and then
+static inline void
+Poll( const Barrier *b, unsigned int *polls )
+{
+	#if defined( __x86_64__ ) || defined( __i386__ )
+		__builtin_ia32_pause( );
+	#endif
+	if( ++*polls % b->yieldEvery == 0 ) sched_yield( );
+}
+
+static void
+FutexWait( int *addr, int val )
+{
+	syscall( SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0 );
+}
+
+static void
+FutexWake( int *addr )
+{
+	syscall( SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0 );
+}
+
+// Index of the barrier called name, or -1
+int
+BarrierKind( const char *name )
+{
+	for( int k = 0; k < NUMBARRIERS; k++ )
+		if( strcmp( name, BARRIERNAMES[k] ) == 0 ) return k;
+	return -1;
+}
+
+// Sets up a barrier of kind for n threads; call before the parallel region
+void
+BarrierInit( Barrier *b, int kind, int n )
+{
+	b->kind = kind;
+	b->n = n;
+	b->rounds = 0;
+	while( ( 1 << b->rounds ) < n ) b->rounds++;
+
+	bool oversubscribed = n > omp_get_num_procs( );
+	b->yieldEvery = oversubscribed ? 1 : BARRIER_YIELD;
+	b->spins = oversubscribed ? 0 : BARRIER_SPINS;
+
+	b->count = 0;
+	b->sense = 0;
+	b->sleepers = 0;
+
+	b->slots = (BarrierSlot *) aligned_alloc( BARRIER_LINE, n * sizeof(BarrierSlot) );
+	memset( b->slots, 0, n * sizeof(BarrierSlot) );
+}
+
+// Last arrival resets the count and flips the shared sense; returns the sense to wait for
+static inline int
+Arrive( Barrier *b, BarrierSlot *s, bool *last )
+{
+	int sense = s->sense = !s->sense;
+
+	*last = __atomic_add_fetch( &b->count, 1, __ATOMIC_ACQ_REL ) == b->n;
+	if( *last )
+	{
+		__atomic_store_n( &b->count, 0, __ATOMIC_RELAXED );	// nobody touches count again until sense flips
+		__atomic_store_n( &b->sense, sense, __ATOMIC_SEQ_CST );
+	}
+
+	return sense;
+}
+
+// Waits until all b->n threads have called it; me is the caller's number
+void
+BarrierWait( Barrier *b, int me )
+{
+	BarrierSlot *s = &b->slots[me];
+	unsigned int polls = 0;
+	bool last;
+
+	switch( b->kind )
+	{
+		case BARRIER_OMP:
+		{
+			#pragma omp barrier
+			break;
+		}
+
+		case BARRIER_SENSE:
+		{
+			int sense = Arrive( b, s, &last );
+			if( last ) break;
+
+			while( __atomic_load_n( &b->sense, __ATOMIC_ACQUIRE ) != sense )
+				Poll( b, &polls );
+			break;
+		}
+
+		case BARRIER_DISSEM:
+		{
+			uint32_t episode = ++s->episode;
+
+			for( int r = 0; r < b->rounds; r++ )
+			{
+				BarrierSlot *partner = &b->slots[ ( me + ( 1 << r ) ) % b->n ];
+				__atomic_store_n( &partner->flags[r], episode, __ATOMIC_RELEASE );
+
+				// A partner can be at most one episode ahead, hence >= and not ==
+				while( __atomic_load_n( &s->flags[r], __ATOMIC_ACQUIRE ) < episode )
+					Poll( b, &polls );
+			}
+			break;
+		}
+
+		case BARRIER_FUTEX:
+		{
+			int sense = Arrive( b, s, &last );
+			if( last )
+			{
+				// Pairs with the sleepers increment below: one side always sees the other
+				if( __atomic_load_n( &b->sleepers, __ATOMIC_SEQ_CST ) > 0 ) FutexWake( &b->sense );
+				break;
+			}
+
+			for( int i = 0; i < b->spins; i++ )
+			{
+				if( __atomic_load_n( &b->sense, __ATOMIC_ACQUIRE ) == sense ) return;
+				#if defined( __x86_64__ ) || defined( __i386__ )
+					__builtin_ia32_pause( );
+				#endif
+			}
+
+			__atomic_add_fetch( &b->sleepers, 1, __ATOMIC_SEQ_CST );
+			while( __atomic_load_n( &b->sense, __ATOMIC_SEQ_CST ) != sense )
+				FutexWait( &b->sense, !sense );		// returns at once if sense already flipped
+			__atomic_sub_fetch( &b->sleepers, 1, __ATOMIC_SEQ_CST );
+			break;
+		}
+	}
+}
+
+void
+BarrierDestroy( Barrier *b )
+{
+	free( b->slots );
+	b->slots = NULL;
+}
@@ -0,0 +1,76 @@
+#include <stdint.h>
+
+#ifndef BARRIER_H
+#define BARRIER_H
+
+/*	Barriers for a fixed team of threads, numbered 0 to n-1, that all
+	run inside one OpenMP parallel region.
+
+	omp		#pragma omp barrier, for comparison
+	sense	sense-reversing centralized barrier: one shared arrival count,
+			everyone spins on one shared sense flag the last arrival flips
+	dissem	dissemination barrier: ceil(log2 n) rounds, in round r thread i
+			signals thread i + 2^r and waits for i - 2^r, each on its own
+			cache line, so no line is written by more than one thread per round
+	futex	sense barrier that spins BARRIER_SPINS times, then sleeps in
+			futex(2) until the last arrival wakes it
+
+	The spinning barriers pause between polls and yield the CPU every
+	BARRIER_YIELD polls. A team larger than the CPU count yields on every
+	poll and the futex barrier sleeps without spinning, as libgomp does,
+	since the thread being waited for cannot run while we spin.
+*/
+
+enum { BARRIER_OMP, BARRIER_SENSE, BARRIER_DISSEM, BARRIER_FUTEX, NUMBARRIERS };
+
+#define BARRIER_LINE	64
+#define BARRIER_ROUNDS	32
+
+// Polls before the futex barrier goes to sleep
+#ifndef BARRIER_SPINS
+	#define BARRIER_SPINS 2000
+#endif
+
+// Polls between sched_yield calls in the spinning barriers
+#ifndef BARRIER_YIELD
+	#define BARRIER_YIELD 1024
+#endif
+
+/* One thread's private barrier state, alone on its line */
+struct barrierslot
+{
+	// dissem: flags[r] is written by this thread's round-r partner only
+	uint32_t flags[ BARRIER_ROUNDS ] __attribute__(( aligned( BARRIER_LINE ) ));
+	uint32_t episode;		// dissem: barriers passed
+	int sense;				// sense, futex: the sense this thread waits for
+};
+
+typedef struct barrierslot BarrierSlot;
+
+struct barrier
+{
+	int kind;
+	int n;
+	int rounds;				// dissem: ceil(log2 n)
+	unsigned int yieldEvery;	// polls between yields
+	int spins;				// futex: polls before sleeping
+
+	// sense, futex: arrivals, then the shared sense, each on its own line
+	int count __attribute__(( aligned( BARRIER_LINE ) ));
+	int sense __attribute__(( aligned( BARRIER_LINE ) ));
+	int sleepers;			// futex: threads that may be asleep on sense
+
+	BarrierSlot *slots __attribute__(( aligned( BARRIER_LINE ) ));
+};
+
+typedef struct barrier Barrier;
+
+extern const char *BARRIERNAMES[NUMBARRIERS];
+
+int		BarrierKind( const char * );
+void	BarrierInit( Barrier *, int, int );
+void	BarrierWait( Barrier *, int );
+void	BarrierDestroy( Barrier * );
+
+
+#endif		// BARRIER_H
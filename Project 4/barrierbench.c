@@ -0,0 +1,72 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <omp.h>
+#include "barrier.h"
+
+/*	Barrier latency: a team of n threads does nothing but pass ITERS
+	barriers back to back, for every barrier in barrier.h and every team
+	size in SIZES up to maxthreads. Teams larger than the CPU count are
+	oversubscribed, which is reported rather than skipped.
+
+	Run as: barrierbench [maxthreads] [iters]
+	Output (CSV): Barrier,Threads,Oversubscribed,ns/barrier
+*/
+
+#ifndef ITERS
+	#define ITERS 20000
+#endif
+
+#define WARMUP 100
+
+static const int SIZES[] = { 3, 4, 8, 16, 32, 64 };
+
+// Seconds per barrier for a team of n threads
+double Latency( int kind, int n, int iters )
+{
+	Barrier b;
+	double tStart = 0., tEnd = 0.;
+
+	BarrierInit( &b, kind, n );
+
+	#pragma omp parallel num_threads(n)
+	{
+		int me = omp_get_thread_num( );
+
+		for( int i = 0; i < WARMUP; i++ )
+			BarrierWait( &b, me );
+
+		if( me == 0 ) tStart = omp_get_wtime( );
+
+		for( int i = 0; i < iters; i++ )
+			BarrierWait( &b, me );
+
+		if( me == 0 ) tEnd = omp_get_wtime( );
+	}
+
+	BarrierDestroy( &b );
+
+	return ( tEnd - tStart ) / iters;
+}
+
+int main( int argc, char **argv )
+{
+	int maxThreads = argc > 1 ? atoi( argv[1] ) : 64;
+	int iters = argc > 2 ? atoi( argv[2] ) : ITERS;
+	int procs = omp_get_num_procs( );
+
+	omp_set_dynamic( 0 );
+
+	fprintf( stdout, "Barrier,Threads,Oversubscribed,ns/barrier\n" );
+
+	for( unsigned int s = 0; s < sizeof(SIZES) / sizeof(SIZES[0]) && SIZES[s] <= maxThreads; s++ )
+	{
+		for( int k = 0; k < NUMBARRIERS; k++ )
+		{
+			double t = Latency( k, SIZES[s], iters );
+			fprintf( stdout, "%s,%d,%s,%.1lf\n", BARRIERNAMES[k], SIZES[s], SIZES[s] > procs ? "yes" : "no", t * 1000000000. );
+			fflush( stdout );
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,212 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <omp.h>
+#include "grain.h"
+#include "../Common/bench.h"
+
+/*	Monte Carlo ensemble of grain simulations.
+
+	Each simulation owns its state instead of sharing the Now* globals. The
+	state is kept SoA in blocks of BLOCK simulations, so one month of the
+	grain, graindeer, greenhouse and weather rules runs as a single vector
+	loop across a block. Threads take whole blocks and run them from
+	MONTHSTART to YearStop with no synchronization; the per-month history
+	is then reduced to percentiles across all simulations.
+*/
+
+// Simulations advanced together in one vector loop
+#ifndef BLOCK
+	#define BLOCK 256
+#endif
+
+#define NUMPCT 5
+static const float PERCENTILES[NUMPCT] = { 5., 25., 50., 75., 95. };
+
+static int CompareFloats( const void *, const void * );
+static void Percentiles( float *, int, float * );
+
+/*	Simulations s0 to s0+n-1 (n <= BLOCK) from MONTHSTART for months
+	months, recording each month's state into the month-major histories.
+	GREEN is Greenhouse, fixed at compile time so the vector loop carries
+	no gas branch. */
+template <bool GREEN>
+static void SimulateBlock( int s0, int n, int sims, int months, unsigned int seed,
+	float *histHeight, float *histDeer, float *histGas )
+{
+	float height[BLOCK], temp[BLOCK], precip[BLOCK], gas[BLOCK];
+	int numDeer[BLOCK];
+
+	// Starting state and the starting month's weather
+	float ang = MonthAngle( MONTHSTART );
+	float c = cosf( ang ), sn = sinf( ang );
+
+	#pragma omp simd
+	for( int k = 0; k < n; k++ )
+	{
+		height[k] = GRAINSTART;
+		numDeer[k] = DEERSTART;
+		gas[k] = GASSTART;
+
+		float gf = GasFactor( gas[k] ), uTemp, uPrecip;
+		WeatherDraws( seed, s0 + k, 0, &uTemp, &uPrecip );
+		temp[k] = Temperature( c, gf, uTemp );
+		precip[k] = Precipitation( sn, gf, uPrecip );
+	}
+
+	for( int m = 0; m < months; m++ )
+	{
+		// Weather for the month after this one, the same for every lane
+		int month = ( MONTHSTART + m + 1 ) % 12;
+		ang = MonthAngle( month );
+		c = cosf( ang );
+		sn = sinf( ang );
+
+		float *hh = &histHeight[ (size_t)m * sims + s0 ];
+		float *hd = &histDeer[ (size_t)m * sims + s0 ];
+		float *hg = &histGas[ (size_t)m * sims + s0 ];
+
+		#pragma omp simd
+		for( int k = 0; k < n; k++ )
+		{
+			// compute phase: everything from last month's values
+			float h = NextHeight( height[k], numDeer[k], temp[k], precip[k] );
+			int d = NextNumDeer( numDeer[k], height[k] );
+			float g = GREEN ? NextGreenGas( gas[k], numDeer[k], height[k] ) : gas[k];
+
+			// assign phase
+			height[k] = h;
+			numDeer[k] = d;
+			gas[k] = g;
+
+			// observe phase: record, then next month's weather
+			hh[k] = h;
+			hd[k] = (float) d;
+			hg[k] = g;
+
+			float gf = GasFactor( g ), uTemp, uPrecip;
+			WeatherDraws( seed, s0 + k, m + 1, &uTemp, &uPrecip );
+			temp[k] = Temperature( c, gf, uTemp );
+			precip[k] = Precipitation( sn, gf, uPrecip );
+		}
+	}
+}
+
+/*	Runs sims independent simulations on threads threads and prints, for
+	every month, the 5/25/50/75/95th percentiles of grain height, deer and
+	gas across them. Simulation s draws its weather from Philox stream s,
+	so results do not depend on the thread count. */
+int RunEnsemble( int sims, int threads, unsigned int seed )
+{
+	int months = ( YearStop - YEARSTART ) * 12 - MONTHSTART;
+	if( sims < 1 || threads < 1 || months < 1 ) return EXIT_FAILURE;
+
+	// History, month-major: [m*sims + s]
+	size_t cells = (size_t)months * sims;
+	float *histHeight = (float *) malloc( cells * sizeof(float) );
+	float *histDeer = (float *) malloc( cells * sizeof(float) );
+	float *histGas = (float *) malloc( cells * sizeof(float) );
+
+	int nblocks = ( sims + BLOCK - 1 ) / BLOCK;
+
+	std::unique_ptr<Counters> ctrs( Counters::Enabled( ) ? new Counters( threads ) : NULL );
+	if( ctrs ) ctrs->start( );
+
+	double tStart = omp_get_wtime( );
+
+	// The greenhouse rule is chosen once here, not per lane and month
+	void (*block)( int, int, int, int, unsigned int, float *, float *, float * ) =
+		Greenhouse ? SimulateBlock<true> : SimulateBlock<false>;
+
+	#pragma omp parallel for num_threads(threads) schedule(dynamic)
+	for( int b = 0; b < nblocks; b++ )
+	{
+		int s0 = b * BLOCK;
+		int n = sims - s0 < BLOCK ? sims - s0 : BLOCK;
+
+		block( s0, n, sims, months, seed, histHeight, histDeer, histGas );
+	}
+
+	double tEnd = omp_get_wtime( );
+	if( ctrs ) ctrs->stop( );
+
+	// One row of percentiles per month; months are independent
+	float *pct = (float *) malloc( (size_t)months * 3 * NUMPCT * sizeof(float) );
+
+	#pragma omp parallel for num_threads(threads) schedule(dynamic)
+	for( int m = 0; m < months; m++ )
+	{
+		float *col = (float *) malloc( sims * sizeof(float) );
+		float *hists[3] = { histHeight, histDeer, histGas };
+
+		for( int v = 0; v < 3; v++ )
+		{
+			memcpy( col, &hists[v][ (size_t)m * sims ], sims * sizeof(float) );
+			Percentiles( col, sims, &pct[ ( (size_t)m * 3 + v ) * NUMPCT ] );
+		}
+
+		free( col );
+	}
+
+	const char *names[3] = { "Height (cm)", "NumDeer", "CO2 Over Baseline (%)" };
+	int nvars = Greenhouse ? 3 : 2;
+
+	fprintf( stdout, "Month,Year" );
+	for( int v = 0; v < nvars; v++ )
+		for( int p = 0; p < NUMPCT; p++ )
+			fprintf( stdout, ",%s p%.0f", names[v], PERCENTILES[p] );
+	fprintf( stdout, "\n" );
+
+	for( int m = 0; m < months; m++ )
+	{
+		// Labelled like PrintState: the month whose growth the row shows
+		int month = ( MONTHSTART + m ) % 12;
+		int year = YEARSTART + ( MONTHSTART + m ) / 12;
+
+		fprintf( stdout, "%d,%d", month, year );
+		for( int v = 0; v < nvars; v++ )
+		{
+			for( int p = 0; p < NUMPCT; p++ )
+			{
+				float x = pct[ ( (size_t)m * 3 + v ) * NUMPCT + p ];
+				fprintf( stdout, ",%lf", v == 0 ? in2cm( x ) : x );
+			}
+		}
+		fprintf( stdout, "\n" );
+	}
+
+	fprintf( stderr, "%d simulations x %d months, %d threads: %lf sec, %lf simulations/sec\n",
+		sims, months, threads, tEnd - tStart, (double)sims / ( tEnd - tStart ) );
+	if( ctrs ) ctrs->print( stderr, "proj4-ensemble" );
+
+	// One run is one sample; repeat the command for more
+	Bench bench( "proj4-ensemble", (double)sims * months, 0, 0 );
+	bench.config( "sims=%d threads=%d", sims, threads );
+	bench.add( tEnd - tStart );
+	bench.report( );
+
+	free( pct );
+	free( histHeight );
+	free( histDeer );
+	free( histGas );
+
+	return EXIT_SUCCESS;
+}
+
+static int CompareFloats( const void *a, const void *b )
+{
+	float x = *(const float *) a, y = *(const float *) b;
+	return ( x > y ) - ( x < y );
+}
+
+// Nearest-rank PERCENTILES of x[0..n-1] into out; sorts x
+static void Percentiles( float *x, int n, float *out )
+{
+	qsort( x, n, sizeof(float), CompareFloats );
+
+	for( int p = 0; p < NUMPCT; p++ )
+	{
+		int rank = (int) ceilf( PERCENTILES[p] / 100.f * n );
+		out[p] = x[ rank < 1 ? 0 : rank - 1 ];
+	}
+}
@@ -0,0 +1,174 @@
+#include <math.h>
+#include <stdbool.h>
+#include "../Common/philox.h"
+
+#ifndef GRAIN_H
+#define GRAIN_H
+
+#ifndef M_PI
+	#define M_PI 3.14159265358979323846264338327950288
+#endif
+
+/*	Simulation settings and month-by-month rules of the grain simulation,
+	shared by the agent simulation (proj4.c) and the ensemble engine
+	(ensemble.c) so both always run the same model. Every rule is a pure
+	function of the values it is given, so it can be applied to the Now*
+	globals or to one lane of an array of simulations alike.
+*/
+
+// Default size of the thread pool that runs the agents (threads=); any count works
+#ifndef THREADCOUNT
+	#define THREADCOUNT 3
+#endif
+
+// Default for greenhouse=; 1 enables the student-added Greenhouse agent
+// (historically enabled by THREADCOUNT=4, which still works)
+#ifndef GREENHOUSE
+	#if THREADCOUNT > 3
+		#define GREENHOUSE 1
+	#else
+		#define GREENHOUSE 0
+	#endif
+#endif
+
+// Simulation begins this month (Default: January)
+#ifndef MONTHSTART
+	#define MONTHSTART 0
+#endif
+
+// Simulation begins this year
+#ifndef YEARSTART
+	#define YEARSTART 2017
+#endif
+
+// Default for yearstop=; simulation stops when this year is reached.
+#ifndef YEARSTOP
+	#define YEARSTOP 2023
+#endif
+
+// Initial grain height
+#ifndef GRAINSTART
+	#define GRAINSTART 1.
+#endif
+
+/* Initial deer population
+		Fun Fact: Graindeer reproduce asexually via spores.
+*/
+#ifndef DEERSTART
+	#define DEERSTART 1
+#endif
+
+// Initial gas over norm
+#ifndef GASSTART
+	#define GASSTART 0
+#endif
+
+/*	The settings that can change without a rebuild, set by proj4 from its
+	parameters before any engine runs (defaults GREENHOUSE and YEARSTOP) */
+extern int Greenhouse;
+extern int YearStop;
+
+static const float GRAIN_GROWS_PER_MONTH = 8.0;
+static const float ONE_DEER_EATS_PER_MONTH = 0.5;
+
+static const float AVG_PRECIP_PER_MONTH = 6.0;	// average
+static const float AMP_PRECIP_PER_MONTH = 6.0;	// variance / amplitude
+static const float RANDOM_PRECIP = 2.0;	// plus or minus noise
+static const float MIDPRECIP = 10.0;
+
+static const float AVG_TEMP = 50.0;	// average
+static const float AMP_TEMP = 20.0;	// variance / amplitude
+static const float RANDOM_TEMP = 10.0;	// plus or minus noise
+static const float MIDTEMP = 40.0;
+
+// Squares a float
+static inline float SQR( float x )
+{
+	return x*x;
+}
+
+// Converts inches to centimeters
+static inline float in2cm ( float x )
+{
+	return x * 2.54;
+}
+
+// Converts degrees Farenheit to degrees Celsius
+static inline float F2C ( float x )
+{
+	return (5./9.)*(x-32);
+}
+
+// Grain: next height from this month's height, deer and weather
+static inline float NextHeight( float height, int numDeer, float temp, float precip )
+{
+	// Divergence from ideal weather: tempFactor * precipFactor as one exp,
+	// which gcc can vectorize where it will not vectorize two in a loop
+	float weatherFactor = expf(   -SQR(  ( temp - MIDTEMP ) / 10.f  ) - SQR(  ( precip - MIDPRECIP ) / 10.f  )   );
+
+	float h = height + weatherFactor * GRAIN_GROWS_PER_MONTH;
+	h -= (float)numDeer * ONE_DEER_EATS_PER_MONTH;
+	return h < 0.f ? 0.f : h;	// No negative heights!
+}
+
+// GrainDeer: the herd grows toward the grain height by one deer a month
+static inline int NextNumDeer( int numDeer, float height )
+{
+	return numDeer + ( (float) numDeer < height ) - ( (float) numDeer > height );
+}
+
+// Greenhouse: gas after a month of deer producing and grain absorbing it
+static inline float NextGreenGas( float gas, int numDeer, float height )
+{
+	gas += (float) numDeer - height / 2.5f;
+	return gas <= -100.f ? -99.f : gas;	// Assume not ALL greenhouse gas can be removed.
+}
+
+// Gas level as a multiplier on the weather
+static inline float GasFactor( float gas )
+{
+	return 1.f + ( gas / 100.f );
+}
+
+// Angle of the month in the seasonal cycle, radians
+static inline float MonthAngle( int month )
+{
+	return (  30.f*(float)month + 15.f  ) * ( M_PI / 180. );
+}
+
+/*	Temperature given cos( MonthAngle ), the gas factor and a uniform
+	random u in [0,1]. Greenhouse gas raises it and widens the noise. */
+static inline float Temperature( float cosAng, float gasFactor, float u )
+{
+	float temp = ( AVG_TEMP - AMP_TEMP * cosAng ) * gasFactor;
+	return temp - RANDOM_TEMP * gasFactor + u * ( 2.f * RANDOM_TEMP * gasFactor );
+}
+
+// Precipitation given sin( MonthAngle ), the gas factor and a uniform u in [0,1]
+static inline float Precipitation( float sinAng, float gasFactor, float u )
+{
+	float precip = ( AVG_PRECIP_PER_MONTH + AMP_PRECIP_PER_MONTH * sinAng ) / gasFactor;
+	precip += -RANDOM_PRECIP * gasFactor + u * ( 2.f * RANDOM_PRECIP * gasFactor );
+	return precip < 0.f ? 0.f : precip;	// "Unrain" is forbidden!
+}
+
+/*	The two uniforms behind a month's weather: lanes 0 and 1 of Philox
+	block month (months since MONTHSTART) of the stream. The agent run is
+	stream 0, ensemble simulation s is stream s and grid cell c is stream
+	c, so the agent run with a seed is simulation 0 of the ensemble. */
+static inline void WeatherDraws( unsigned int seed, unsigned int stream, unsigned int month, float *uTemp, float *uPrecip )
+{
+	float u[4];
+	PhiloxBlock( seed, stream, month, u );
+	*uTemp = u[0];
+	*uPrecip = u[1];
+}
+
+// Ensemble engine (ensemble.c)
+int RunEnsemble( int sims, int threads, unsigned int seed );
+
+// Spatial grid engine (grid.c)
+int RunGrid( int cols, int rows, int threads, unsigned int seed );
+
+
+#endif		// GRAIN_H
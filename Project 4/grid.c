@@ -0,0 +1,401 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <omp.h>
+#include "grain.h"
+#include "../Common/bench.h"
+#include "../Common/trace.h"
+
+/*	Spatially distributed grain simulation.
+
+	A cols x rows grid of fields, each running the Grain, GrainDeer and
+	Greenhouse rules of grain.h on its own state. Weather varies across
+	the grid: colder toward row 0, wetter toward the last column, plus
+	per-cell noise. After the local rules, graindeer migrate: every field
+	sends 1/MIGRATE of its herd (rounded down) to each of its four
+	neighbours with taller grain, so a field's new herd is a 5-point
+	stencil over its neighbours' heights and herds.
+
+	The grid is split into one tile per thread, px x py tiles chosen to
+	keep the tiles square. A tile stores its cells with a one-cell halo
+	ring and is allocated by its own thread. Each month:
+
+		local		rules on the tile's own cells, no neighbours needed
+		exchange	pull the neighbour tiles' edge heights and herds into the halo
+		migrate		stencil from the tile and its halo into the next herd
+
+	with a barrier after local (edges final before anyone reads them) and
+	after exchange (nobody overwrites an edge still being read). Halos on
+	the grid's outer edge stay at height -1 and no deer, so herds never
+	leave the grid.
+*/
+
+// 1/MIGRATE of a herd moves to each neighbour with taller grain
+#ifndef MIGRATE
+	#define MIGRATE 8
+#endif
+
+// Temperature range (degF) from the first row to the last
+#ifndef TEMPSPREAD
+	#define TEMPSPREAD 20.
+#endif
+
+// Precipitation range (inches) from the first column to the last
+#ifndef PRECIPSPREAD
+	#define PRECIPSPREAD 4.
+#endif
+
+/* One thread's piece of the grid, stored with a one-cell halo ring */
+struct tile
+{
+	int x0, y0;				// first grid column and row
+	int w, h;				// cells owned
+	int stride;				// w + 2
+	int left, right, up, down;	// neighbour tile indices, -1 at the grid edge
+	float *height;
+	float *gas;
+	int *deer, *nextDeer;
+};
+
+typedef struct tile Tile;
+
+/* Per-thread totals for one month */
+struct totals
+{
+	double height, gas;
+	long deer, occupied;
+};
+
+typedef struct totals Totals;
+
+static void Split( int cols, int rows, int threads, int *px, int *py );
+static void InitTile( Tile *t, int cols, int rows, int px, int py, int me );
+template <bool GREEN>
+static void LocalRules( Tile *t, int cols, int rows, int m, unsigned int seed );
+static void Exchange( Tile *tiles, int me );
+static void Wait( );
+static void Migrate( Tile *t );
+static Totals Sum( Tile *t );
+
+/*	Runs a cols x rows grid from MONTHSTART to YearStop on threads threads
+	and prints the grid-wide mean height and gas, total herd and the
+	fraction of fields with deer for every month. Prints cell-months/sec
+	on stderr. Results depend on the seed, not on the thread count. */
+int RunGrid( int cols, int rows, int threads, unsigned int seed )
+{
+	int months = ( YearStop - YEARSTART ) * 12 - MONTHSTART;
+	if( cols < 1 || rows < 1 || threads < 1 || months < 1 ) return EXIT_FAILURE;
+
+	int px, py;
+	Split( cols, rows, threads, &px, &py );
+	if( px < 1 )
+	{
+		fprintf( stderr, "Cannot split a %dx%d grid into %d tiles\n", cols, rows, threads );
+		return EXIT_FAILURE;
+	}
+
+	Tile *tiles = (Tile *) calloc( threads, sizeof(Tile) );
+	Totals *hist = (Totals *) calloc( (size_t)threads * months, sizeof(Totals) );	// [thread*months + m]
+
+	double tStart = 0., tEnd = 0.;
+
+	// The greenhouse rule is chosen once here, not per cell and month
+	void (*localRules)( Tile *, int, int, int, unsigned int ) = Greenhouse ? LocalRules<true> : LocalRules<false>;
+
+	// Hardware counts over the timed months, if BENCH_COUNTERS is set
+	std::unique_ptr<Counters> ctrs( Counters::Enabled( ) ? new Counters( threads ) : NULL );
+
+	#pragma omp parallel num_threads(threads)
+	{
+		int me = omp_get_thread_num( );
+		Tile *t = &tiles[me];
+
+		InitTile( t, cols, rows, px, py, me );
+
+		#pragma omp barrier
+		#pragma omp master
+		{
+			if( ctrs ) ctrs->start( );
+			tStart = omp_get_wtime( );
+		}
+
+		for( int m = 0; m < months; m++ )
+		{
+			{
+				TRACE_SCOPE( "rules" );
+				localRules( t, cols, rows, m, seed );
+			}
+
+			Wait( );
+
+			{
+				TRACE_SCOPE( "exchange" );
+				Exchange( tiles, me );
+			}
+
+			Wait( );
+
+			{
+				TRACE_SCOPE( "migrate" );
+				Migrate( t );
+				hist[ (size_t)me * months + m ] = Sum( t );
+			}
+		}
+
+		#pragma omp barrier
+		#pragma omp master
+		{
+			tEnd = omp_get_wtime( );
+			if( ctrs ) ctrs->stop( );
+		}
+
+		free( t->height );
+		free( t->gas );
+		free( t->deer );
+		free( t->nextDeer );
+	}
+
+	fprintf( stdout, "Month,Year,Mean Height (cm),Total Deer,Fields With Deer (%%)" );
+	if( Greenhouse ) fprintf( stdout, ",Mean CO2 Over Baseline (%%)" );
+	fprintf( stdout, "\n" );
+
+	double cells = (double)cols * rows;
+
+	for( int m = 0; m < months; m++ )
+	{
+		Totals sum = { 0., 0., 0, 0 };
+		for( int i = 0; i < threads; i++ )
+		{
+			Totals *x = &hist[ (size_t)i * months + m ];
+			sum.height += x->height;
+			sum.gas += x->gas;
+			sum.deer += x->deer;
+			sum.occupied += x->occupied;
+		}
+
+		// Labelled like PrintState: the month whose growth the row shows
+		fprintf( stdout, "%d,%d,%lf,%ld,%lf", ( MONTHSTART + m ) % 12, YEARSTART + ( MONTHSTART + m ) / 12,
+			in2cm( sum.height / cells ), sum.deer, 100. * sum.occupied / cells );
+		if( Greenhouse ) fprintf( stdout, ",%lf", sum.gas / cells );
+		fprintf( stdout, "\n" );
+	}
+
+	fprintf( stderr, "%dx%d grid, %d threads (%dx%d tiles), %d months: %lf sec, %lf cell-months/sec\n",
+		cols, rows, threads, px, py, months, tEnd - tStart, cells * months / ( tEnd - tStart ) );
+	if( ctrs ) ctrs->print( stderr, "proj4-grid" );
+
+	// One run is one sample; repeat the command for more
+	Bench bench( "proj4-grid", cells * months, 0, 0 );
+	bench.config( "cols=%d rows=%d threads=%d", cols, rows, threads );
+	bench.add( tEnd - tStart );
+	bench.report( );
+
+	free( hist );
+	free( tiles );
+
+	return EXIT_SUCCESS;
+}
+
+/*	px x py = threads tiles with the least halo per cell, or px = 0 if
+	every split leaves a tile with no cells. */
+static void Split( int cols, int rows, int threads, int *px, int *py )
+{
+	double best = 0.;
+	*px = *py = 0;
+
+	for( int y = 1; y <= threads; y++ )
+	{
+		if( threads % y != 0 ) continue;
+		int x = threads / y;
+		if( x > cols || y > rows ) continue;
+
+		double perimeter = (double)cols / x + (double)rows / y;
+		if( *px == 0 || perimeter < best )
+		{
+			best = perimeter;
+			*px = x;
+			*py = y;
+		}
+	}
+}
+
+// Works out tile me's extent and neighbours and first-touches its cells
+static void InitTile( Tile *t, int cols, int rows, int px, int py, int me )
+{
+	int tx = me % px, ty = me / px;
+
+	t->x0 = (int)( (long)tx * cols / px );
+	t->y0 = (int)( (long)ty * rows / py );
+	t->w = (int)( (long)( tx + 1 ) * cols / px ) - t->x0;
+	t->h = (int)( (long)( ty + 1 ) * rows / py ) - t->y0;
+	t->stride = t->w + 2;
+
+	t->left = tx > 0 ? me - 1 : -1;
+	t->right = tx < px - 1 ? me + 1 : -1;
+	t->up = ty > 0 ? me - px : -1;
+	t->down = ty < py - 1 ? me + px : -1;
+
+	size_t n = (size_t)t->stride * ( t->h + 2 );
+	t->height = (float *) malloc( n * sizeof(float) );
+	t->gas = (float *) malloc( n * sizeof(float) );
+	t->deer = (int *) malloc( n * sizeof(int) );
+	t->nextDeer = (int *) malloc( n * sizeof(int) );
+
+	// Halo included: the outer ring keeps these values for good
+	for( size_t i = 0; i < n; i++ )
+	{
+		t->height[i] = -1.f;
+		t->gas[i] = GASSTART;
+		t->deer[i] = 0;
+		t->nextDeer[i] = 0;
+	}
+
+	for( int y = 1; y <= t->h; y++ )
+	{
+		for( int x = 1; x <= t->w; x++ )
+		{
+			t->height[ y * t->stride + x ] = GRAINSTART;
+			t->deer[ y * t->stride + x ] = DEERSTART;
+		}
+	}
+}
+
+// Month m's weather and the Grain, GrainDeer and, if GREEN, Greenhouse rules on every owned cell
+template <bool GREEN>
+static void LocalRules( Tile *t, int cols, int rows, int m, unsigned int seed )
+{
+	float ang = MonthAngle( ( MONTHSTART + m ) % 12 );
+	float c = cosf( ang ), sn = sinf( ang );
+
+	for( int y = 1; y <= t->h; y++ )
+	{
+		int gy = t->y0 + y - 1;
+		float tOff = TEMPSPREAD * ( rows > 1 ? (float)gy / ( rows - 1 ) - 0.5f : 0.f );
+
+		float *height = &t->height[ y * t->stride ];
+		float *gas = &t->gas[ y * t->stride ];
+		int *deer = &t->deer[ y * t->stride ];
+
+		#pragma omp simd
+		for( int x = 1; x <= t->w; x++ )
+		{
+			int gx = t->x0 + x - 1;
+			unsigned int cell = (unsigned int)gy * cols + gx;
+			float pOff = PRECIPSPREAD * ( cols > 1 ? (float)gx / ( cols - 1 ) - 0.5f : 0.f );
+
+			float gf = GasFactor( gas[x] ), uTemp, uPrecip;
+			WeatherDraws( seed, cell, m, &uTemp, &uPrecip );
+
+			float temp = Temperature( c, gf, uTemp ) + tOff;
+			float precip = Precipitation( sn, gf, uPrecip ) + pOff;
+			precip = precip < 0.f ? 0.f : precip;
+
+			float h = NextHeight( height[x], deer[x], temp, precip );
+			int d = NextNumDeer( deer[x], height[x] );
+			if( GREEN ) gas[x] = NextGreenGas( gas[x], deer[x], height[x] );
+
+			height[x] = h;
+			deer[x] = d;
+		}
+	}
+}
+
+// Copies the neighbour tiles' edge heights and herds into this tile's halo
+static void Exchange( Tile *tiles, int me )
+{
+	Tile *t = &tiles[me];
+	int s = t->stride;
+
+	if( t->up >= 0 )
+	{
+		Tile *n = &tiles[ t->up ];
+		memcpy( &t->height[1], &n->height[ n->h * s + 1 ], t->w * sizeof(float) );
+		memcpy( &t->deer[1], &n->deer[ n->h * s + 1 ], t->w * sizeof(int) );
+	}
+
+	if( t->down >= 0 )
+	{
+		Tile *n = &tiles[ t->down ];
+		memcpy( &t->height[ ( t->h + 1 ) * s + 1 ], &n->height[ s + 1 ], t->w * sizeof(float) );
+		memcpy( &t->deer[ ( t->h + 1 ) * s + 1 ], &n->deer[ s + 1 ], t->w * sizeof(int) );
+	}
+
+	// Columns are strided; tiles in one tile row have the same h
+	if( t->left >= 0 )
+	{
+		Tile *n = &tiles[ t->left ];
+		for( int y = 1; y <= t->h; y++ )
+		{
+			t->height[ y * s ] = n->height[ y * n->stride + n->w ];
+			t->deer[ y * s ] = n->deer[ y * n->stride + n->w ];
+		}
+	}
+
+	if( t->right >= 0 )
+	{
+		Tile *n = &tiles[ t->right ];
+		for( int y = 1; y <= t->h; y++ )
+		{
+			t->height[ y * s + t->w + 1 ] = n->height[ y * n->stride + 1 ];
+			t->deer[ y * s + t->w + 1 ] = n->deer[ y * n->stride + 1 ];
+		}
+	}
+}
+
+// Team barrier between the month's stages
+static void Wait( )
+{
+	TRACE_SCOPE( "barrier" );
+	#pragma omp barrier
+}
+
+/*	Graindeer migration: each field keeps what it does not send and takes
+	in 1/MIGRATE of every neighbour herd whose grain is shorter than its own. */
+static void Migrate( Tile *t )
+{
+	int s = t->stride;
+
+	for( int y = 1; y <= t->h; y++ )
+	{
+		const float *h = &t->height[ y * s ];
+		const int *d = &t->deer[ y * s ];
+		int *next = &t->nextDeer[ y * s ];
+
+		#pragma omp simd
+		for( int x = 1; x <= t->w; x++ )
+		{
+			float me = h[x];
+			int share = d[x] / MIGRATE;
+
+			int out = ( h[x-1] > me ) + ( h[x+1] > me ) + ( h[x-s] > me ) + ( h[x+s] > me );
+			int in = ( me > h[x-1] ) * ( d[x-1] / MIGRATE ) + ( me > h[x+1] ) * ( d[x+1] / MIGRATE )
+				+ ( me > h[x-s] ) * ( d[x-s] / MIGRATE ) + ( me > h[x+s] ) * ( d[x+s] / MIGRATE );
+
+			next[x] = d[x] - out * share + in;
+		}
+	}
+
+	int *tmp = t->deer;
+	t->deer = t->nextDeer;
+	t->nextDeer = tmp;
+}
+
+// Totals over the tile's own cells
+static Totals Sum( Tile *t )
+{
+	Totals sum = { 0., 0., 0, 0 };
+
+	for( int y = 1; y <= t->h; y++ )
+	{
+		for( int x = 1; x <= t->w; x++ )
+		{
+			int i = y * t->stride + x;
+			sum.height += t->height[i];
+			sum.gas += t->gas[i];
+			sum.deer += t->deer[i];
+			sum.occupied += t->deer[i] > 0;
+		}
+	}
+
+	return sum;
+}
@@ -11,55 +11,35 @@
 					amount of grain available to eat.
 */
 
+#ifndef _GNU_SOURCE
+	#define _GNU_SOURCE	// getopt
+#endif
 #include <stdlib.h>	// for EXIT_FAILURE / EXIT_SUCCESS
 #include <stdio.h> 	// for printing results
 #include <math.h>
 #include <omp.h>	// OpenMP
 #include <time.h>	// time() for seeding pRNG
 #include <stdbool.h> // bool type
-
-#ifndef M_PI
-	#define M_PI 3.14159265358979323846264338327950288
-#endif
-
-// Option macros to be set on compile if desired.
-
-// Minimum 3 required for basic funtionality
-// Set to 4 to enable student-added section
-#ifndef THREADCOUNT
-	#define THREADCOUNT 3
-#endif
-
-// Simulation begins this month (Default: January)
-#ifndef MONTHSTART
-	#define MONTHSTART 0
-#endif
-
-// Simulation begins this year
-#ifndef YEARSTART
-	#define YEARSTART 2017
-#endif
-
-// Simulation stops when this year is reached.
-#ifndef YEARSTOP
-	#define YEARSTOP 2023
-#endif
-
-// Initial grain height
-#ifndef GRAINSTART
-	#define GRAINSTART 1.
-#endif
-
-/* Initial deer population
-		Fun Fact: Graindeer reproduce asexually via spores.
-*/ 
-#ifndef DEERSTART
-	#define DEERSTART 1
+#include <unistd.h>	// getopt
+#include "grain.h"	// settings and rules
+#include "statelog.h"	// background state writer
+#include "barrier.h"	// phase barriers
+#include "../Common/bench.h"	// month-step statistics
+#include "../Common/config.h"	// key=value parameters
+#include "../Common/topology.h"	// thread placement
+#include "../Common/trace.h"	// per-thread timeline
+
+// Option macros to be set on compile if desired; the simulation ones live in grain.h.
+// Each is only the default of the parameter named after it.
+
+// async=; set to 0 to print the monthly state from the Watcher itself, as before
+#ifndef ASYNCPRINT
+	#define ASYNCPRINT 1
 #endif
 
-// Initial gas over norm 
-#ifndef GASSTART
-	#define GASSTART 0
+// plots=; extra independent grain plots, each its own agent, for scheduler load tests
+#ifndef PLOTS
+	#define PLOTS 0
 #endif
 
 /*
@@ -76,231 +56,418 @@ float NowGreenGas = GASSTART;	// additional atmospheric greenouse gas content
 float NowPrecip;	// inches of rain per month
 float NowTemp;		// temperature this month
 
-const float GRAIN_GROWS_PER_MONTH = 8.0;
-const float ONE_DEER_EATS_PER_MONTH = 0.5;
+int Greenhouse = GREENHOUSE;	// greenhouse=
+int YearStop = YEARSTOP;		// yearstop=
 
-const float AVG_PRECIP_PER_MONTH = 6.0;	// average
-const float AMP_PRECIP_PER_MONTH = 6.0;	// variance / amplitude
-const float RANDOM_PRECIP = 2.0;	// plus or minus noise
-const float MIDPRECIP = 10.0;
+/*
+	Phased agent scheduler
+
+	Every simulated month runs three phases, separated by barriers:
+		compute:	agents read the Now* state and work out their next values
+		assign:		agents write their next values into the Now* state
+		observe:	agents look at the finished month (print, advance the clock)
+	Agents register a callback per phase (NULL to skip it) and a fixed pool
+	of threads shares out the agents of each phase, so adding an
+	agent no longer means adding a thread.
+*/
+struct agent
+{
+	const char *name;
+	void (*compute)( struct agent * );
+	void (*assign)( struct agent * );
+	void (*observe)( struct agent * );
+	void *data;		// agent-private state
+};
+
+typedef struct agent Agent;
+
+enum { COMPUTE, ASSIGN, OBSERVE, NUMPHASES };
+
+const char *PHASENAMES[NUMPHASES] = { "compute", "assign", "observe" };
+
+Agent *Agents = NULL;
+int NumAgents = 0;
+double PhaseTime[NUMPHASES];	// wall seconds spent in each phase, barrier included
+long Months = 0;				// month-steps simulated
+double WorstMonth = 0.;			// longest single month-step, seconds
+Bench *MonthBench = NULL;		// every month-step's time, one sample each
+
+StateLog *Log = NULL;			// monthly state writer; NULL prints directly
 
-const float AVG_TEMP = 50.0;	// average
-const float AMP_TEMP = 20.0;	// variance / amplitude
-const float RANDOM_TEMP = 10.0;	// plus or minus noise
-const float MIDTEMP = 40.0; 
+Barrier PhaseBarrier;			// ends every phase
+int BarrierType = BARRIER_OMP;
 
+// Next-month values held between the compute and assign phases
+int NewNumDeer;
+float NewHeight;
+float NewGreenGas;
 
-void GrainDeer();
-void Grain();
-void Watcher( unsigned int *seedp );
-void Greenhouse();
-void SetWeather();
+/* A private grain field with its own graindeer, under the shared weather */
+struct plot
+{
+	float height, nextHeight;
+	int numDeer, nextNumDeer;
+};
+
+typedef struct plot Plot;
+
+
+void AddAgent( const char *name, void (*compute)( Agent * ), void (*assign)( Agent * ), void (*observe)( Agent * ), void *data );
+void RunAgents( int threads );
+void PhaseWait( int me );
+void GrainDeerCompute( Agent * );
+void GrainDeerAssign( Agent * );
+void GrainCompute( Agent * );
+void GrainAssign( Agent * );
+void Watcher( Agent * );
+void GreenhouseCompute( Agent * );
+void GreenhouseAssign( Agent * );
+void PlotCompute( Agent * );
+void PlotAssign( Agent * );
+void SetWeather( unsigned int seed );
 void PrintState( bool state );
-float Ranf( unsigned int *seedp,  float low, float high );
-float SQR( float x );
-float in2cm ( float x );
-float F2C ( float x );
 
 
+/*	Run as: proj4 [-e sims | -g colsxrows] [-t threads] [-s seed] [-b file] [-d file] [-B barrier] [key=value ...]
+	-e runs a Monte Carlo ensemble of sims independent simulations on
+	-t threads (default THREADCOUNT) and prints per-month percentiles
+	instead of the single agent-based run. -g runs a cols x rows grid of
+	fields with migrating graindeer instead. -s fixes the seed. -b writes
+	the monthly state to file as binary records instead of CSV on stdout,
+	and -d prints such a file as CSV. -B picks the barrier that ends each
+	phase: omp (default), sense, dissem or futex.
+
+	Parameters, defaulting to the macros of the same name:
+		threads		same as -t (THREADCOUNT)
+		greenhouse	0 or 1, the Greenhouse agent and gas rule (GREENHOUSE)
+		yearstop	year the simulation stops at (YEARSTOP)
+		plots		extra grain plot agents (PLOTS)
+		async		0 prints the state from the Watcher (ASYNCPRINT)
+		place		pins the threads: none (default), compact, scatter,
+					core or socket (Common/topology.h)
+		config		file of key=value lines
+	BENCH_TRACE=file.json records every thread's phases, agent calls and
+	barrier waits, or its grid rules, exchanges and barriers
+	(Common/trace.h). */
 int main (int argc, char **argv)
 {
-	// Check for invalid starting state
-	if (THREADCOUNT < 3 || NowYear >= YEARSTOP || NowMonth < 0 || NowMonth > 11) exit(EXIT_FAILURE);
-
-	// Set weather for initial month
 	unsigned int seed = time(NULL);
-	SetWeather( &seed );
-
-	// Print header
-	PrintState( false );
+	int sims = 0;
+	int cols = 0, rows = 0;
+	const char *binFile = NULL;
+	int threads = THREADCOUNT;
+	int opt;
 
-	omp_set_num_threads( THREADCOUNT );
-	#pragma omp parallel sections
+	while( ( opt = getopt( argc, argv, "e:g:t:s:b:d:B:" ) ) != -1 )
 	{
-		#pragma omp section
+		switch( opt )
 		{
-			GrainDeer( );
+			case 'e': sims = atoi( optarg ); break;
+			case 'g':
+				if( sscanf( optarg, "%dx%d", &cols, &rows ) != 2 ) cols = rows = 0;
+				break;
+			case 't': threads = atoi( optarg ); break;
+			case 's': seed = strtoul( optarg, NULL, 0 ); break;
+			case 'b': binFile = optarg; break;
+			case 'd': return StateLogDecode( optarg, stdout );
+			case 'B':
+				if( ( BarrierType = BarrierKind( optarg ) ) < 0 )
+				{
+					fprintf( stderr, "Unknown barrier %s\n", optarg );
+					exit(EXIT_FAILURE);
+				}
+				break;
+			default:
+				fprintf( stderr, "Invalid syntax. Try %s [-e sims | -g colsxrows] [-t threads] [-s seed] [-b file] [-d file] [-B barrier] [key=value ...]\n", argv[0] );
+				exit(EXIT_FAILURE);
 		}
+	}
 
-		#pragma omp section
-		{
-			Grain( );
-		}
+	Config cfg( argc, argv, optind );
+	threads = cfg.get( "threads", threads );
+	Greenhouse = cfg.get( "greenhouse", Greenhouse ) != 0;
+	YearStop = cfg.get( "yearstop", YearStop );
+	int numPlots = cfg.get( "plots", PLOTS );
+	bool async = cfg.get( "async", ASYNCPRINT ) != 0;
+	int place = cfg.choice( "place", PLACENAMES, NUMPLACES, PLACE_NONE );
+	if( !cfg.check( stderr ) ) exit(EXIT_FAILURE);
+
+	// Check for invalid starting state
+	if (threads < 1 || numPlots < 0 || NowYear >= YearStop || NowMonth < 0 || NowMonth > 11) exit(EXIT_FAILURE);
+
+	// Every engine runs a team of threads threads
+	Topology::Place( place, threads );
 
-		#pragma omp section
+	if( sims > 0 ) return RunEnsemble( sims, threads, seed );
+	if( cols > 0 ) return RunGrid( cols, rows, threads, seed );
+
+	// Set weather for initial month
+	SetWeather( seed );
+
+	// State goes through the background writer unless printing inline
+	FILE *binFp = NULL;
+	if( binFile != NULL )
+	{
+		if( ( binFp = fopen( binFile, "wb" ) ) == NULL )
 		{
-			Watcher( &seed );
+			perror( binFile );
+			exit(EXIT_FAILURE);
 		}
+		Log = StateLogCreate( binFp, 1, Greenhouse );
+	}
+	else if( async )
+		Log = StateLogCreate( stdout, 0, Greenhouse );
 
-		#if THREADCOUNT > 3
-			#pragma omp section
-			{
-				Greenhouse( );
-			}
-		#endif
+	// Print header
+	PrintState( false );
+
+	// Register agents; the order within a phase does not matter
+	AddAgent( "GrainDeer", GrainDeerCompute, GrainDeerAssign, NULL, NULL );
+	AddAgent( "Grain", GrainCompute, GrainAssign, NULL, NULL );
+	AddAgent( "Watcher", NULL, NULL, Watcher, &seed );
+
+	if( Greenhouse )
+		AddAgent( "Greenhouse", GreenhouseCompute, GreenhouseAssign, NULL, NULL );
+
+	Plot *plots = (Plot *) calloc( numPlots > 0 ? numPlots : 1, sizeof(Plot) );
+	for( int p = 0; p < numPlots; p++ )
+	{
+		plots[p].height = GRAINSTART;
+		plots[p].numDeer = DEERSTART;
+		AddAgent( "Plot", PlotCompute, PlotAssign, NULL, &plots[p] );
 	}
-}
 
-// Calculates graindeer population
-void GrainDeer()
-{
-	while(NowYear < YEARSTOP) {
-
-		// Compute new graindeer count in local variable
-		int NewNumDeer = NowNumDeer;
-		if ( (float) NowNumDeer < NowHeight) NewNumDeer++;
-		else if ( (float) NowNumDeer > NowHeight) NewNumDeer--;
-		#pragma omp barrier // Done Computing
-
-		// Copy new graindeer count into global variable
-		NowNumDeer = NewNumDeer;
-		#pragma omp barrier	// Done Assigning
-		#pragma omp barrier // Done Printing
+	Bench monthBench( "proj4", 1., 0, 0 );
+	monthBench.config( "agents=%d threads=%d barrier=%s", NumAgents, threads, BARRIERNAMES[BarrierType] );
+	MonthBench = &monthBench;
+
+	// Hardware counts over the whole run, if BENCH_COUNTERS is set
+	std::unique_ptr<Counters> ctrs( Counters::Enabled( ) ? new Counters( threads ) : NULL );
+	if( ctrs ) ctrs->start( );
+
+	double tStart = omp_get_wtime( );
+	RunAgents( threads );
+	double tEnd = omp_get_wtime( );
+
+	if( ctrs ) ctrs->stop( );
+
+	// Drain the writer before reporting; the drain is not part of the run time
+	bool writer = Log != NULL;
+	long stalls = 0;
+	if( writer )
+	{
+		stalls = Log->stalls;
+		StateLogClose( Log );
+		Log = NULL;
 	}
+	if( binFp != NULL ) fclose( binFp );
+
+	// Scheduler report on stderr so stdout stays the CSV
+	fprintf( stderr, "%d agents, %d threads, %s barrier: %ld months in %lf sec, %lf month-steps/sec\n",
+		NumAgents, threads, BARRIERNAMES[BarrierType], Months, tEnd - tStart, (double)Months / ( tEnd - tStart ) );
+	for( int ph = 0; ph < NUMPHASES; ph++ )
+		fprintf( stderr, "  %-8s %10.3lf us/month\n", PHASENAMES[ph], PhaseTime[ph] / Months * 1000000. );
+	fprintf( stderr, "  %-8s %10.3lf us\n", "worst", WorstMonth * 1000000. );
+	const BenchStats &stats = monthBench.stats( );
+	fprintf( stderr, "  %-8s %10.3lf us/month, p95 %.3lf us\n", "median", stats.median * 1000000., stats.p95 * 1000000. );
+	monthBench.report( );
+	if( writer ) fprintf( stderr, "  %-8s %10ld full ring waits\n", "writer", stalls );
+	if( ctrs ) ctrs->print( stderr, "proj4" );
+
+	free( plots );
+	free( Agents );
+
+	return EXIT_SUCCESS;
 }
 
-// Calculates grain height
-void Grain()
+// Registers an agent; any of the phase callbacks may be NULL
+void AddAgent( const char *name, void (*compute)( Agent * ), void (*assign)( Agent * ), void (*observe)( Agent * ), void *data )
 {
-	while(NowYear < YEARSTOP) {
-
-		// Calculate divergence from ideal weather
-		float tempFactor = exp(   -SQR(  ( NowTemp - MIDTEMP ) / 10.  )   );
-		float precipFactor = exp(   -SQR(  ( NowPrecip - MIDPRECIP ) / 10.  )   );	
-
-		// Calculate new height into a local variable
-		float NewHeight = NowHeight;
-		NewHeight += tempFactor * precipFactor * GRAIN_GROWS_PER_MONTH;
-		NewHeight -= (float)NowNumDeer * ONE_DEER_EATS_PER_MONTH;
-		if (NewHeight < 0. ) NewHeight = 0.; // No negative heights!
-		#pragma omp barrier // Done Computing
-
-		NowHeight = NewHeight;
-		#pragma omp barrier	// Done Assigning
-		#pragma omp barrier // Done Printing
-	}
+	Agents = (Agent *) realloc( Agents, ( NumAgents + 1 ) * sizeof(Agent) );
+
+	Agent *a = &Agents[NumAgents++];
+	a->name = name;
+	a->compute = compute;
+	a->assign = assign;
+	a->observe = observe;
+	a->data = data;
 }
 
-// Prints results, increments month/year, sets weather
-void Watcher(unsigned int *seedp)
+/*	Runs every registered agent through compute, assign and observe each
+	month until YearStop on threads threads. The barrier after each worksharing loop (nowait,
+	so it is the only one) is the old "Done Computing", "Done Assigning"
+	or "Done Printing" barrier; BarrierType picks its implementation. */
+void RunAgents( int threads )
 {
-	
-	while(NowYear < YEARSTOP) {
-		#pragma omp barrier // Done Computing
-		#pragma omp barrier	// Done Assigning
-		
-		// PRINT RESULTS
-		PrintState( true );
-
-		// Increment Month/Year
-		if ( ++NowMonth == 12 ) {
-			NowMonth = 0;
-			NowYear++;
-		}
+	// The custom barriers need exactly threads threads
+	omp_set_dynamic( 0 );
+	omp_set_num_threads( threads );
+	BarrierInit( &PhaseBarrier, BarrierType, threads );
 
-		// Set new weather conditions
-		SetWeather(seedp);
-		#pragma omp barrier // Done Printing
-	}
-}
+	#pragma omp parallel default(none) shared(Agents, NumAgents, NowYear, YearStop, PhaseTime, PHASENAMES, Months, WorstMonth, MonthBench, PhaseBarrier)
+	{
+		int me = omp_get_thread_num( );
+		bool timer = me == 0;
+		double t0 = omp_get_wtime( ), t1, tMonth = t0;
 
-/*	Computes the impact of graindeer & grain on
-	atmospheric greenhouse gas content as percentage
-	over/under baseline */
-void Greenhouse()
-{
-	while(NowYear < YEARSTOP) {
+		// Everyone reads NowYear after the observe barrier, so all threads agree
+		while( NowYear < YearStop ) {
+
+			{
+				TRACE_SCOPE( PHASENAMES[COMPUTE] );
+				#pragma omp for schedule(dynamic) nowait
+				for( int i = 0; i < NumAgents; i++ )
+					if( Agents[i].compute != NULL )
+					{
+						TRACE_SCOPE( Agents[i].name );
+						Agents[i].compute( &Agents[i] );
+					}
+			}
+			PhaseWait( me );
+
+			if( timer ) { t1 = omp_get_wtime( ); PhaseTime[COMPUTE] += t1 - t0; t0 = t1; }
+
+			{
+				TRACE_SCOPE( PHASENAMES[ASSIGN] );
+				#pragma omp for schedule(dynamic) nowait
+				for( int i = 0; i < NumAgents; i++ )
+					if( Agents[i].assign != NULL )
+					{
+						TRACE_SCOPE( Agents[i].name );
+						Agents[i].assign( &Agents[i] );
+					}
+			}
+			PhaseWait( me );
 
-		float NewGreenGas = (float) NowNumDeer; // Deer produce gas (e.g., CO2)		
-		NewGreenGas -= (float) NowHeight / 2.5; // Grain absorbs gas (i.e., CO2)
-		#pragma omp barrier // Done Computing
+			if( timer ) { t1 = omp_get_wtime( ); PhaseTime[ASSIGN] += t1 - t0; t0 = t1; }
 
-		NowGreenGas += NewGreenGas; // Update global gas value.
-		if ( NowGreenGas <= -100. ) NowGreenGas = -99; // Assume not ALL greenhouse gas can be removed.
+			{
+				TRACE_SCOPE( PHASENAMES[OBSERVE] );
+				#pragma omp for schedule(dynamic) nowait
+				for( int i = 0; i < NumAgents; i++ )
+					if( Agents[i].observe != NULL )
+					{
+						TRACE_SCOPE( Agents[i].name );
+						Agents[i].observe( &Agents[i] );
+					}
+			}
+			PhaseWait( me );
 
-		#pragma omp barrier	// Done Assigning
-		#pragma omp barrier // Done Printing
+			if( timer ) {
+				t1 = omp_get_wtime( ); PhaseTime[OBSERVE] += t1 - t0; t0 = t1; Months++;
+				if( t1 - tMonth > WorstMonth ) WorstMonth = t1 - tMonth;
+				MonthBench->add( t1 - tMonth );
+				tMonth = t1;
+			}
+		}
 	}
+
+	BarrierDestroy( &PhaseBarrier );
 }
 
-// Set the NowTemp and NowPrecip global floats
-void SetWeather(unsigned int *seedp)
+// Ends a phase at PhaseBarrier; me is the caller's thread number
+void PhaseWait( int me )
 {
-	// Calculate impact of gas content on weather
-	float GasFactor = 1. + ( NowGreenGas / 100. );
-
-	float ang = (  30.*(float)NowMonth + 15.  ) * ( M_PI / 180. );
+	TRACE_SCOPE( "barrier" );
+	BarrierWait( &PhaseBarrier, me );
+}
 
-	 // Greenhouse effect on temperature
-	float temp = ( AVG_TEMP - AMP_TEMP * cos( ang ) ) * GasFactor;
-	// Greenhouse effect increases unpredictability
-	NowTemp = temp + Ranf( seedp, ( -RANDOM_TEMP * GasFactor ), ( RANDOM_TEMP * GasFactor ) ); 
+// Calculates graindeer population
+void GrainDeerCompute( Agent * )
+{
+	NewNumDeer = NextNumDeer( NowNumDeer, NowHeight );
+}
 
-	// Greenhouse effect on baseline precipitation
-	float precip = ( AVG_PRECIP_PER_MONTH + AMP_PRECIP_PER_MONTH * sin( ang ) ) / GasFactor; 
-	// Greenhouse effect increases unpredictability
-	NowPrecip = precip + Ranf( seedp,  ( -RANDOM_PRECIP * GasFactor ), ( RANDOM_PRECIP * GasFactor ) );  
+// Copy new graindeer count into global variable
+void GrainDeerAssign( Agent * )
+{
+	NowNumDeer = NewNumDeer;
+}
 
-	// "Unrain" is forbidden!
-	if( NowPrecip < 0. ) NowPrecip = 0.;
+// Calculates grain height
+void GrainCompute( Agent * )
+{
+	NewHeight = NextHeight( NowHeight, NowNumDeer, NowTemp, NowPrecip );
 }
 
-void PrintState( bool state )
+void GrainAssign( Agent * )
 {
-	// If state not indicated, print header and return
-	if ( !state ) {
-		fprintf( stdout, "Month,Year,Temp (C),Precip (cm),Height (cm),NumDeer");
+	NowHeight = NewHeight;
+}
 
-		#if THREADCOUNT > 3
-			fprintf( stdout, ",CO2 Over Baseline (\%)" );
-		#endif
+// Prints results, increments month/year, sets weather
+void Watcher( Agent *a )
+{
+	unsigned int seed = *(unsigned int *) a->data;
 
-		fprintf( stdout, "\n" );
+	// PRINT RESULTS
+	PrintState( true );
 
-		return;
+	// Increment Month/Year
+	if ( ++NowMonth == 12 ) {
+		NowMonth = 0;
+		NowYear++;
 	}
 
-	// Otherwise print state values
-	fprintf( stdout, "%d,%d,%lf,%lf,%lf,%d", NowMonth,NowYear,F2C(NowTemp),in2cm(NowPrecip),in2cm(NowHeight),NowNumDeer);
-
-	#if THREADCOUNT > 3
-		fprintf( stdout, ",%lf", NowGreenGas );
-	#endif
-
-	fprintf( stdout, "\n" );
+	// Set new weather conditions
+	SetWeather( seed );
 }
 
-// Get a random float between ilow and ihigh
-float Ranf( unsigned int *seedp,  float low, float high )
+/*	Computes the impact of graindeer & grain on
+	atmospheric greenhouse gas content as percentage
+	over/under baseline */
+void GreenhouseCompute( Agent * )
 {
-        float r = (float) rand_r( seedp );              // 0 - RAND_MAX
+	NewGreenGas = NextGreenGas( NowGreenGas, NowNumDeer, NowHeight );
+}
 
-        return(   low  +  r * ( high - low ) / (float)RAND_MAX   );
+void GreenhouseAssign( Agent * )
+{
+	NowGreenGas = NewGreenGas; // Update global gas value.
 }
-/*
-// Get a random int between ilow and ihigh
-int Rani( unsigned int *seedp, int ilow, int ihigh )
+
+// Grain and GrainDeer rules for one private plot, under this month's weather
+void PlotCompute( Agent *a )
 {
-        float low = (float)ilow;
-        float high = (float)ihigh + 0.9999f;
+	Plot *p = (Plot *) a->data;
 
-        return (int)(  Ranf(seedp, low,high) );
+	p->nextHeight = NextHeight( p->height, p->numDeer, NowTemp, NowPrecip );
+	p->nextNumDeer = NextNumDeer( p->numDeer, p->height );
 }
-*/
-// Squares a float
-float SQR( float x )
+
+void PlotAssign( Agent *a )
 {
-	return x*x;
+	Plot *p = (Plot *) a->data;
+
+	p->height = p->nextHeight;
+	p->numDeer = p->nextNumDeer;
 }
 
-// Converts inches to centimeters
-float in2cm ( float x )
+// Set the NowTemp and NowPrecip global floats, from Philox stream 0 of seed
+void SetWeather( unsigned int seed )
 {
-	return x * 2.54;
+	// Calculate impact of gas content on weather
+	float gasFactor = GasFactor( NowGreenGas );
+	float ang = MonthAngle( NowMonth );
+
+	float uTemp, uPrecip;
+	WeatherDraws( seed, 0, ( NowYear - YEARSTART ) * 12 + NowMonth - MONTHSTART, &uTemp, &uPrecip );
+
+	NowTemp = Temperature( cosf( ang ), gasFactor, uTemp );
+	NowPrecip = Precipitation( sinf( ang ), gasFactor, uPrecip );
 }
 
-// Converts degrees Farenheit to degrees Celsius
-float F2C ( float x )
+void PrintState( bool state )
 {
-	return (5./9.)*(x-32);
-}
\ No newline at end of file
+	// If state not indicated, print header and return; the writer printed its own
+	if ( !state ) {
+		if( Log == NULL ) StateLogPrintHeader( stdout, Greenhouse );
+		return;
+	}
+
+	// Otherwise hand the state values to the writer, or print them here
+	StateRecord r = { NowMonth, NowYear, NowNumDeer, NowTemp, NowPrecip, NowHeight, NowGreenGas };
+
+	if( Log != NULL ) StateLogPush( Log, &r );
+	else StateLogPrint( stdout, &r, Greenhouse );
+}
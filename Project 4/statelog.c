@@ -0,0 +1,174 @@
+#ifndef _GNU_SOURCE
+	#define _GNU_SOURCE	// nanosleep, sched_yield
+#endif
+#include "statelog.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include "grain.h"	// F2C, in2cm
+
+
+// How long the writer sleeps when the ring is empty, nanoseconds
+#ifndef STATELOG_IDLE
+	#define STATELOG_IDLE 100000
+#endif
+
+// Writes one record out in the log's format
+static void
+StateLogWrite( StateLog *l, const StateRecord *r )
+{
+	if( l->binary )
+		fwrite( r, sizeof(StateRecord), 1, l->fp );
+	else
+		StateLogPrint( l->fp, r, l->greenhouse );
+}
+
+// Background thread: drain the ring until it is empty and the log is closed
+static void *
+StateLogThread( void *arg )
+{
+	StateLog *l = (StateLog *) arg;
+	struct timespec idle = { 0, STATELOG_IDLE };
+	uint64_t tail = l->tail;
+
+	for( ;; )
+	{
+		uint64_t head = __atomic_load_n( &l->head, __ATOMIC_ACQUIRE );
+
+		if( tail == head )
+		{
+			// done is set after the last push, so a head read after it is final
+			if( __atomic_load_n( &l->done, __ATOMIC_ACQUIRE ) &&
+				__atomic_load_n( &l->head, __ATOMIC_ACQUIRE ) == tail ) break;
+
+			fflush( l->fp );
+			nanosleep( &idle, NULL );
+			continue;
+		}
+
+		for( ; tail != head; tail++ )
+		{
+			StateLogWrite( l, &l->ring[ tail & ( STATELOG_RING - 1 ) ] );
+			__atomic_store_n( &l->tail, tail + 1, __ATOMIC_RELEASE );
+		}
+	}
+
+	fflush( l->fp );
+
+	return NULL;
+}
+
+/*	Starts a writer thread that formats records onto fp: CSV (with the
+	gas column if greenhouse), or raw records after a StateLogHeader if
+	binary. Prints the CSV header or writes the binary header now. */
+StateLog *
+StateLogCreate( FILE *fp, int binary, int greenhouse )
+{
+	StateLog *l = (StateLog *) aligned_alloc( STATELOG_LINE, sizeof(StateLog) );
+	memset( l, 0, sizeof(StateLog) );
+
+	l->ring = (StateRecord *) calloc( STATELOG_RING, sizeof(StateRecord) );
+	l->fp = fp;
+	l->binary = binary;
+	l->greenhouse = greenhouse;
+
+	if( binary )
+	{
+		StateLogHeader h;
+		memset( &h, 0, sizeof(h) );
+		memcpy( h.magic, STATELOG_MAGIC, sizeof(h.magic) );
+		h.greenhouse = greenhouse;
+		h.recordBytes = sizeof(StateRecord);
+		fwrite( &h, sizeof(h), 1, fp );
+	}
+	else
+		StateLogPrintHeader( fp, greenhouse );
+
+	pthread_create( &l->thread, NULL, StateLogThread, l );
+
+	return l;
+}
+
+// Queues one record; only one thread may push to a log
+void
+StateLogPush( StateLog *l, const StateRecord *r )
+{
+	uint64_t head = l->head;
+
+	if( head - l->cachedTail >= STATELOG_RING )
+	{
+		l->cachedTail = __atomic_load_n( &l->tail, __ATOMIC_ACQUIRE );
+		if( head - l->cachedTail >= STATELOG_RING )
+		{
+			l->stalls++;
+			while( head - l->cachedTail >= STATELOG_RING )
+			{
+				sched_yield( );
+				l->cachedTail = __atomic_load_n( &l->tail, __ATOMIC_ACQUIRE );
+			}
+		}
+	}
+
+	l->ring[ head & ( STATELOG_RING - 1 ) ] = *r;
+	__atomic_store_n( &l->head, head + 1, __ATOMIC_RELEASE );
+}
+
+// Waits for the writer to drain the ring and stops it; fp is left open
+void
+StateLogClose( StateLog *l )
+{
+	__atomic_store_n( &l->done, 1, __ATOMIC_RELEASE );
+	pthread_join( l->thread, NULL );
+
+	free( l->ring );
+	free( l );
+}
+
+void
+StateLogPrintHeader( FILE *fp, int greenhouse )
+{
+	fprintf( fp, "Month,Year,Temp (C),Precip (cm),Height (cm),NumDeer" );
+	if( greenhouse ) fprintf( fp, ",CO2 Over Baseline (%%)" );
+	fprintf( fp, "\n" );
+}
+
+// One CSV row, in PrintState's units
+void
+StateLogPrint( FILE *fp, const StateRecord *r, int greenhouse )
+{
+	fprintf( fp, "%d,%d,%lf,%lf,%lf,%d", r->month, r->year, F2C( r->temp ), in2cm( r->precip ), in2cm( r->height ), r->numDeer );
+	if( greenhouse ) fprintf( fp, ",%lf", r->gas );
+	fprintf( fp, "\n" );
+}
+
+// Prints a binary state file as CSV
+int
+StateLogDecode( const char *path, FILE *out )
+{
+	FILE *fp = fopen( path, "rb" );
+	if( fp == NULL )
+	{
+		perror( path );
+		return EXIT_FAILURE;
+	}
+
+	StateLogHeader h;
+	if( fread( &h, sizeof(h), 1, fp ) != 1 || memcmp( h.magic, STATELOG_MAGIC, sizeof(h.magic) ) != 0
+		|| h.recordBytes != sizeof(StateRecord) )
+	{
+		fprintf( stderr, "%s: not a grain state file\n", path );
+		fclose( fp );
+		return EXIT_FAILURE;
+	}
+
+	StateLogPrintHeader( out, h.greenhouse );
+
+	StateRecord r;
+	while( fread( &r, sizeof(r), 1, fp ) == 1 )
+		StateLogPrint( out, &r, h.greenhouse );
+
+	fclose( fp );
+
+	return EXIT_SUCCESS;
+}
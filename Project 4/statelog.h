@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#ifndef STATELOG_H
+#define STATELOG_H
+
+/*	Monthly state output off the simulation's critical path.
+
+	The Watcher pushes one fixed-size StateRecord per month into a
+	single-producer/single-consumer ring and goes straight back to the
+	barrier. A background thread pops records and formats them, as the
+	usual CSV or as raw records (binary mode):
+
+	StateLogHeader
+	StateRecord, StateRecord, ...	(native byte order)
+
+	The ring needs no lock: only the producer writes head and only the
+	writer writes tail, each on its own cache line. The producer spins
+	only if the writer falls a whole ring behind.
+*/
+
+#define STATELOG_MAGIC	"GRAINST1"
+
+// Records in the ring; a power of two
+#ifndef STATELOG_RING
+	#define STATELOG_RING 4096
+#endif
+
+#define STATELOG_LINE	64
+
+struct staterecord
+{
+	int32_t month, year;
+	int32_t numDeer;
+	float temp;			// degF
+	float precip;		// inches
+	float height;		// inches
+	float gas;			// percent over baseline
+};
+
+typedef struct staterecord StateRecord;
+
+struct statelogheader
+{
+	char magic[8];
+	int32_t greenhouse;		// gas column present
+	int32_t recordBytes;
+};
+
+typedef struct statelogheader StateLogHeader;
+
+struct statelog
+{
+	// Producer's line: its index and its last look at the writer's
+	uint64_t head __attribute__(( aligned( STATELOG_LINE ) ));
+	uint64_t cachedTail;
+	long stalls;			// pushes that found the ring full
+
+	// Writer's line
+	uint64_t tail __attribute__(( aligned( STATELOG_LINE ) ));
+	int done;
+
+	StateRecord *ring __attribute__(( aligned( STATELOG_LINE ) ));
+	FILE *fp;
+	int binary;
+	int greenhouse;
+	pthread_t thread;
+};
+
+typedef struct statelog StateLog;
+
+StateLog *	StateLogCreate( FILE *, int, int );
+void		StateLogPush( StateLog *, const StateRecord * );
+void		StateLogClose( StateLog * );
+
+void		StateLogPrintHeader( FILE *, int );
+void		StateLogPrint( FILE *, const StateRecord *, int );
+int			StateLogDecode( const char *, FILE * );
+
+
+#endif		// STATELOG_H
@@ -1,9 +1,12 @@
 
 #include "simd.p5.h"
-#include <cfloat>
-#include <functional>
+#include "../Common/bench.h"
+#include "../Common/config.h"
+#include <algorithm>
+
+/*	Run as: proj5 [len=N] [tries=N] [warmup=N] [verbose=0|1] [config=file]
+	The -D values below are the defaults. */
 
-using std::function; 	// GetTime parameters
 using std::fill_n; 		// Array filling
 
 // Set to nonzero for verbose logging
@@ -11,64 +14,88 @@ using std::fill_n; 		// Array filling
 	#define VERBOSE 0
 #endif
 
-/* float array element count
+/* default float array element count
 	Set to 0 to print header and exit */
 #ifndef LEN
 	#define LEN 1000
 #endif
 
-/* Number of loops to average to ensure data integrity
-	Set to > 1 to enable confirmation */
+/* Timed runs per kernel; the median of those left after outlier
+	rejection is the kernel's time */
 #ifndef TRIES
 	#define TRIES 1
 #endif
 
-// Number of attempts to get good data before aborting
-#ifndef ABORT
-	#define ABORT 256
+// Untimed runs per kernel before the timed ones
+#ifndef WARMUP
+	#define WARMUP 4
 #endif
 
-// Global arrays.
-float A[LEN];
-float B[LEN]; 
-float C[LEN];
+// Global arrays, Len long.
+float *A;
+float *B; 
+float *C;
+int Len = LEN;
+int Verbose = VERBOSE;
+
+// Counter column prefixes, in the order the kernels are timed
+const char *KERNELNAMES[4] = { "SISD Mul ", "SIMD Mul ", "SISD MulSum ", "SIMD MulSum " };
 
 // Function prototypes
-void err( const char * );
 void SisdMul( float *, float *, float *, int );
-float SisdMulSum( float *a, float *b, float *c, int len );
-float GetTime( function<void( float *, float *, float *, int )> );
-float GetTime( function<float( float *, float *, int )> );
+float SisdMulSum( float *a, float *b, int len );
+template <typename F> double GetTime( const char *, F, int, int, CounterSet * );
 
 int main (int argc, char **argv)
 {
+	Config cfg( argc, argv );
+	Len = cfg.get( "len", LEN );
+	int tries = cfg.get( "tries", TRIES );
+	int warmup = cfg.get( "warmup", WARMUP );
+	Verbose = cfg.get( "verbose", VERBOSE );
+	if ( !cfg.check( stderr ) ) return EXIT_FAILURE;
+
+	// Display the header and exit on zero length, before anything is timed or reported
+	if ( !( Len ) ) {
+		fprintf ( stdout, "Array Size,SIMD Mult Speedup,SIMD Mult+Red Speedup" );
+		for( int k = 0; k < 4; k++ )
+			Bench::CounterHeader( stdout, KERNELNAMES[k] );
+		fprintf ( stdout, "\n" );
+		return EXIT_SUCCESS;
+	}
+
+	// 16-byte aligned like the SSE loads want
+	size_t bytes = ( Len * sizeof(float) + 15 ) & ~(size_t)15;
+	A = (float *) aligned_alloc( 16, bytes );
+	B = (float *) aligned_alloc( 16, bytes );
+	C = (float *) aligned_alloc( 16, bytes );
+
 	// Fill arrays with arbitrary values
-	fill_n( B, LEN, 222.323 );
-	fill_n( C, LEN, 323.222 );
+	fill_n( A, Len, 0.f );
+	fill_n( B, Len, 222.323 );
+	fill_n( C, Len, 323.222 );
 
-	// Get the data
-	float 	SpeedupMul = 	GetTime( SisdMul ) 		/ GetTime( SimdMul ),
-			SpeedupMulSum =	GetTime( SisdMulSum )	/ GetTime( SimdMulSum );
+	// Get the data, and each kernel's counters if counting
+	CounterSet counts[4];
+	float 	SpeedupMul = 	GetTime( "proj5-sisd-mul", [ ]( ) { SisdMul( A, B, C, Len ); ClobberMemory( ); }, warmup, tries, &counts[0] )
+						/	GetTime( "proj5-simd-mul", [ ]( ) { SimdMul( A, B, C, Len ); ClobberMemory( ); }, warmup, tries, &counts[1] ),
+			SpeedupMulSum =	GetTime( "proj5-sisd-mulsum", [ ]( ) { DoNotOptimize( SisdMulSum( A, B, Len ) ); }, warmup, tries, &counts[2] )
+						/	GetTime( "proj5-simd-mulsum", [ ]( ) { DoNotOptimize( SimdMulSum( A, B, Len ) ); }, warmup, tries, &counts[3] );
 
-	// Display the header and exit on zero LEN
-	if ( !( LEN ) ) {
-		fprintf ( stdout, "Array Size,SIMD Mult Speedup,SIMD Mult+Red Speedup\n" );
-		return EXIT_SUCCESS;
-	}
+	free( A );
+	free( B );
+	free( C );
 
 	// Display the data
-	fprintf( stdout, "%d,%8.2lf,%8.2lf\n", LEN, SpeedupMul, SpeedupMulSum );
+	fprintf( stdout, "%d,%8.2lf,%8.2lf", Len, SpeedupMul, SpeedupMulSum );
+	if( Counters::Enabled( ) )
+		for( int k = 0; k < 4; k++ )
+			Counters::Columns( stdout, counts[k] );
+	fprintf( stdout, "\n" );
 
 	return EXIT_SUCCESS;
 }
 
-// Print error message and exit with error
-void err( const char *msg )
-{
-	fprintf( stderr, "%s\n", msg );
-	exit( EXIT_FAILURE );
-}
-
 // Single Instruction Single Data array multiplication
 void SisdMul( float *a, float *b, float *c, int len )
 {
@@ -78,7 +105,7 @@ void SisdMul( float *a, float *b, float *c, int len )
 }
 
 // Single Instruction Single Data array multiplication + reduction
-float SisdMulSum( float *a, float *b, float *c, int len )
+float SisdMulSum( float *a, float *b, int len )
 {
 	float sum = 0.;
 
@@ -89,82 +116,22 @@ float SisdMulSum( float *a, float *b, float *c, int len )
 	return sum;
 }
 
-// Gets a verified reliable time for peak array multiply performance.
-float GetTime( function<void(float *, float *, float *, int)> Mul )
+/*	Median time of one call of kernel, through the shared harness, with
+	its hardware counts per call in *counts (none unless BENCH_COUNTERS is set) */
+template <typename F>
+double GetTime( const char *name, F kernel, int warmup, int tries, CounterSet *counts )
 {
-	int 	count = 0;
-
-	double	time0,
-			time1,
-			ratio,
-		 	avg = 0,
-			peak = DBL_MAX;
-
-	do{
-		count++;
-
-		for (int i = 0; i < TRIES; i++ ) {
-			time0 = omp_get_wtime();
-			Mul( A, B, C, LEN );
-			time1 = omp_get_wtime();
+	Bench bench( name, Len, warmup, tries );
+	bench.config( "len=%d", Len );
+	bench.count( 1 );
 
-			// Record times
-			avg += time1 - time0;
-			if ( peak > time1 - time0 ) peak = time1 - time0;
-		}
+	const BenchStats &stats = bench.run( kernel );
+	bench.report( );
 
-		avg /= TRIES;
+	if ( Verbose ) bench.print( stderr );
 
-		// Calculate ratio for peak & avg
-		ratio = peak > avg ? avg / peak : peak / avg;
-	
-	// Repeat until peak is within 20% of average
-	} while ( (ratio <= .8) && count < ABORT );
+	if ( bench.counters( ) != NULL ) *counts = bench.counters( )->perRun( );
+	else *counts = CounterSet( );
 
-	if (count >= ABORT) err("No reliable data available. Aborted!");
-
-	if ( VERBOSE ) fprintf( stderr, "Count: %d\tavg: %lf\tpeak: %lf\tratio: %lf\n", count, avg, peak, ratio);
-
-	return peak;
+	return stats.median;
 }
-
-/* Gets a verified reliable time for peak array multiply + reduce performance.
-	Yes, there is duplicate code. I didn't take the time to handle differing signatures. :-| */
-float GetTime( function<float(float *, float *, int)> MulSum )
-{
-	int 	count = 0;
-
-	double	time0,
-			time1,
-			ratio,
-		 	avg = 0,
-			peak = DBL_MAX;
-
-	do{
-		count++;
-
-		for (int i = 0; i < TRIES; i++ ) {
-			time0 = omp_get_wtime();
-			MulSum( A, B, LEN ); // We don't care about the return value
-			time1 = omp_get_wtime();
-
-			// Record times
-			avg += time1 - time0;
-			if ( peak > time1 - time0 ) peak = time1 - time0;
-		}
-
-		avg /= TRIES;
-
-		// Calculate ratio for peak & avg
-		ratio = peak > avg ? avg / peak : peak / avg;
-
-		
-	// Repeat until peak is within 20% of average
-	} while ( (ratio <= .8) && count < ABORT );
-
-	if (count >= ABORT) err("No reliable data available. Aborted!");
-
-	if ( VERBOSE ) fprintf ( stderr, "Count: %d\tavg: %lf\tpeak: %lf\tratio: %lf\n", count, avg, peak, ratio);
-
-	return peak;
-}
\ No newline at end of file